@@ -0,0 +1,187 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+// Turns what a debug build sends over the UART back into text: the trace
+// events (see lib/include/trace.h) are decoded, the text messages
+// sent with dmaSend in between them are passed through.
+// The recording of the game's input (see gietar-hiero/replay.h) comes in
+// frames after TR_REPLAY events, with --replay it's written to a file which
+// game_sim --replay and the -DREPLAY firmware play.
+//
+//   trace_decoder [--replay replay.txt] [device or capture file, /dev/ttyACM0 by default, - for stdin]
+
+namespace {
+
+struct EventInfo {
+    std::string_view name;
+    std::string_view format;
+};
+
+constexpr EventInfo events[] = {
+#define TRACE_EVENT(name, format) {#name, format},
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+
+enum EventId : unsigned {
+#define TRACE_EVENT(name, format) name,
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+
+constexpr unsigned char TRACE_MARK = 0x80;
+constexpr size_t EVENT_SIZE = 8;
+
+std::string decode(const unsigned char* event) {
+    unsigned id = event[0] & ~TRACE_MARK;
+    unsigned a = event[1];
+    uint16_t b = event[2] | event[3] << 8;
+    uint32_t tick = event[4] | event[5] << 8 | event[6] << 16 | static_cast<uint32_t>(event[7]) << 24;
+
+    std::string line = "[" + std::to_string(tick) + "] ";
+    if (id >= std::size(events)) {
+        return line + "unknown event " + std::to_string(id) + " a=" + std::to_string(a) + " b=" + std::to_string(b);
+    }
+    line += events[id].name;
+    line += ": ";
+    std::string_view format = events[id].format;
+    for (size_t i = 0; i < format.size(); ++i) {
+        if (format[i] != '%' || i + 1 == format.size()) {
+            line += format[i];
+            continue;
+        }
+        switch (format[++i]) {
+            case 'a': line += std::to_string(a); break;
+            case 'b': line += std::to_string(b); break;
+            case 'B': line += std::to_string(static_cast<int16_t>(b)); break;
+            default: line += format[i]; break;
+        }
+    }
+    return line;
+}
+
+// the bytes of the replay frames, as the contents of a byte array (like songs.txt)
+class ReplayWriter {
+public:
+    bool open(const std::string& path) {
+        out_.open(path);
+        out_ << "// replay, recorded by trace_decoder\n";
+        return static_cast<bool>(out_);
+    }
+
+    // frames are numbered, a lost one leaves a gap the replay can't get over
+    void startFrame(uint16_t frame) {
+        if (frames_ > 0 && frame != next_frame_) {
+            std::cerr << "Replay frames " << next_frame_ << " to " << frame - 1
+                      << " are missing, the replay is only good up to them" << std::endl;
+        }
+        next_frame_ = frame + 1;
+        frames_++;
+    }
+
+    void put(unsigned char byte) {
+        if (!out_.is_open()) {
+            return;
+        }
+        char text[8];
+        snprintf(text, sizeof(text), "0x%02x,%c", byte, ++bytes_ % 16 == 0 ? '\n' : ' ');
+        out_ << text;
+    }
+
+    void endFrame() {
+        out_.flush();
+    }
+
+private:
+    std::ofstream out_;
+    uint16_t next_frame_ = 0;
+    unsigned long frames_ = 0;
+    unsigned long bytes_ = 0;
+};
+
+}
+
+int main(int argc, char** argv) {
+    std::string path = "/dev/ttyACM0";
+    ReplayWriter replay;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc) {
+            if (!replay.open(argv[++i])) {
+                std::cerr << "Error opening " << argv[i] << ": " << strerror(errno) << std::endl;
+                return 1;
+            }
+        } else {
+            path = arg;
+        }
+    }
+    auto fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening " << path << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    unsigned char buf[2048];
+    unsigned char event[EVENT_SIZE];
+    size_t event_length = 0; // bytes of an event read so far
+    size_t replay_left = 0; // bytes of a replay frame still to come
+    bool line_start = true; // of the text being passed through
+
+    while (true) {
+        auto bytes_read = read(fd, buf, sizeof(buf));
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error reading from board: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < bytes_read; ++i) {
+            unsigned char byte = buf[i];
+            if (replay_left > 0) {
+                replay.put(byte);
+                if (--replay_left == 0) {
+                    replay.endFrame();
+                }
+            } else if (event_length > 0 || (byte & TRACE_MARK)) {
+                event[event_length++] = byte;
+                if (event_length < EVENT_SIZE) {
+                    continue;
+                }
+                event_length = 0;
+                if ((event[0] & ~TRACE_MARK) == TR_REPLAY) {
+                    // not shown, there's one every second
+                    replay.startFrame(event[2] | event[3] << 8);
+                    replay_left = event[1];
+                    continue;
+                }
+                // events get lines of their own, even in the middle of a message
+                if (!line_start) {
+                    std::cout << '\n';
+                }
+                std::cout << decode(event) << '\n';
+                line_start = true;
+            } else {
+                std::cout << byte;
+                line_start = byte == '\n';
+            }
+        }
+        std::cout.flush();
+    }
+    if (event_length > 0) {
+        std::cerr << "Capture ends in the middle of an event" << std::endl;
+    }
+    if (replay_left > 0) {
+        std::cerr << "Capture ends in the middle of a replay frame" << std::endl;
+    }
+}
@@ -0,0 +1,163 @@
+import json
+import sys
+
+# Compiles charts (song.json and the others written by generate_song.py) into
+# the song library read by game.c, written as the contents of a byte array
+# (songs.txt):
+#   compile_chart.py chart.json... songs.txt
+#
+# Chart times are in divisions of a beat ("resolution" per beat), the tempo
+# map turns them into song time (ticks of 10 ms, 16 fractional bits).
+#
+# Packed format, little endian, varints are 7 bits per byte, low bits first,
+# the top bit set on all but the last byte.
+# The library:
+#   u8      number of songs
+#   index, INDEX_ENTRY_SIZE bytes per song:
+#     u32     offset of the chart, from the start of the library
+#     u32     length in ticks, up to the end of the last note
+#     u16     number of notes
+#     title, TITLE_SIZE bytes, padded with zeros (so at most TITLE_SIZE - 1 characters)
+#   the charts
+# A chart:
+#   u16     number of notes
+#   u8      number of tempo changes, at least one
+#   tempo changes:
+#     varint  divisions since the previous change (the first one is at 0)
+#     u32     song time per division from there on
+#   u8      notes from one checkpoint to the next, a checkpoint for every
+#           CHECKPOINT_STEP notes, starting with the first one
+#   checkpoints, for seeking without reading the notes before them:
+#     u32     offset of the note, from the start of the chart
+#     u32     division of the note before it (0 for the first one)
+#     u32     length of the note before it
+#     i64     song time of the note
+#   notes, ordered by time:
+#     varint  divisions since the previous note << 4 | new length << 3 | column - 1
+#     u8      pitch, octave * 12 + letter - 1 (as note_lengths.txt is ordered)
+#     varint  length in divisions, only if new length is set, otherwise
+#             the note is as long as the one before it
+# A note's length is converted with the tempo at its start.
+
+TICK_SECONDS = 0.01
+TIME_FRAC_BITS = 16
+COLUMNS = 4 # N_COLS in keyboard.h
+CHECKPOINT_STEP = 16
+CHECKPOINT_SIZE = 20
+TITLE_SIZE = 22
+INDEX_ENTRY_SIZE = 10 + TITLE_SIZE
+
+
+def varint(value):
+  assert value >= 0
+  out = []
+  while value >= 0x80:
+    out.append(value & 0x7f | 0x80)
+    value >>= 7
+  out.append(value)
+  return out
+
+
+def u32(value):
+  return list(value.to_bytes(4, 'little'))
+
+
+def pack(chart):
+  resolution = chart['resolution']
+  tempo = sorted(chart['tempo'], key=lambda change: change['at'])
+  notes = sorted(chart['notes'], key=lambda note: note['at'])
+  assert tempo and tempo[0]['at'] == 0, 'the tempo has to be set at 0'
+  assert len(tempo) < 256 and len(notes) < 65536
+
+  out = list(len(notes).to_bytes(2, 'little'))
+  out.append(len(tempo))
+  changes = []
+  at = 0
+  for change in tempo:
+    seconds = 60 / change['bpm'] / resolution
+    per_division = round(seconds / TICK_SECONDS * (1 << TIME_FRAC_BITS))
+    out += varint(change['at'] - at)
+    out += u32(per_division)
+    at = change['at']
+    changes.append((at, per_division))
+
+  # song time at a division, summed exactly like game.c does
+  def time_at(division):
+    time = 0
+    for i, (at, per_division) in enumerate(changes):
+      end = changes[i + 1][0] if i + 1 < len(changes) else division
+      time += (min(end, division) - at) * per_division
+      if end >= division:
+        return time
+    return time
+
+  def per_division_at(division):
+    return [per_division for at, per_division in changes if at <= division][-1]
+
+  out.append(CHECKPOINT_STEP)
+  checkpoints_at = len(out)
+  checkpoint_count = (len(notes) + CHECKPOINT_STEP - 1) // CHECKPOINT_STEP
+  out += [0] * (checkpoint_count * CHECKPOINT_SIZE)
+  header = len(out)
+
+  at = 0
+  length = None
+  for i, note in enumerate(notes):
+    assert 1 <= note['column'] <= COLUMNS, note
+    assert 1 <= note['letter'] <= 12 and 0 <= note['octave'] <= 8, note
+    if i % CHECKPOINT_STEP == 0:
+      checkpoint = u32(len(out)) + u32(at) + u32(length or 0)
+      checkpoint += list(time_at(note['at']).to_bytes(8, 'little', signed=True))
+      start = checkpoints_at + i // CHECKPOINT_STEP * CHECKPOINT_SIZE
+      out[start:start + CHECKPOINT_SIZE] = checkpoint
+    new_length = note['length'] != length
+    out += varint((note['at'] - at) << 4 | new_length << 3 | note['column'] - 1)
+    out.append(note['octave'] * 12 + note['letter'] - 1)
+    if new_length:
+      out += varint(note['length'])
+    at = note['at']
+    length = note['length']
+
+  end = 0
+  if notes:
+    last = notes[-1]
+    end = time_at(last['at']) + last['length'] * per_division_at(last['at'])
+  ticks = -(-end >> TIME_FRAC_BITS) # rounded up
+  return out, header, ticks
+
+
+def library(charts):
+  assert 0 < len(charts) < 256
+  index = [len(charts)]
+  packed = []
+  offset = 1 + len(charts) * INDEX_ENTRY_SIZE
+  for chart in charts:
+    out, header, ticks = pack(chart)
+    title = chart['title'].encode('ascii')[:TITLE_SIZE - 1]
+    index += u32(offset) + u32(ticks) + list(len(chart['notes']).to_bytes(2, 'little'))
+    index += list(title.ljust(TITLE_SIZE, b'\0'))
+    packed += out
+    offset += len(out)
+    print(f'{chart["title"]}: {len(chart["notes"])} notes, {header} bytes of header, '
+          f'{len(out) - header} bytes of notes, {ticks // 6000}:{ticks // 100 % 60:02}')
+  return index + packed
+
+
+def main():
+  if len(sys.argv) < 3:
+    print(f'usage: {sys.argv[0]} chart.json... songs.txt')
+    sys.exit(2)
+  *sources, target = sys.argv[1:]
+  charts = []
+  for source in sources:
+    with open(source) as f:
+      charts.append(json.load(f))
+  out = library(charts)
+  with open(target, 'w') as outf:
+    outf.write(f'// {len(charts)} songs in {len(out)} bytes\n')
+    for i in range(0, len(out), 16):
+      outf.write(', '.join(f'0x{b:02x}' for b in out[i:i + 16]) + ',\n')
+
+
+if __name__ == "__main__":
+  main()
@@ -2,15 +2,21 @@
 board = "board.bmp", 128, 160
 note = "note.bmp", 32, 20
 
+# Sprite sheets (see LcdImage in lcd.h): frames of any size next to each other
+# in one bmp, their alpha in another bmp of the same size, white is opaque,
+# as (pixels, alpha) pairs. Either one can be None: the note is only alpha,
+# tinted by lcd.c. Both are written to a .txt named like their bmp.
+sheets = [(None, note)]
+
 def read_bmp(info):
   filename, width, height = info
   with open(filename, 'rb') as f:
     bts = f.read()[70:] # skip header
   print(f'{len(bts)=}')
   assert len(bts) == width * height * 2
-  
+
   # now we read row-by-row from bottom to top because bmp weirdness
-  real = ''
+  rows = []
   for i in range(height - 1, -1, -1):
     row_start = i * width * 2
     row = bts[row_start:row_start + width * 2]
@@ -19,10 +25,17 @@ def read_bmp(info):
     assert len(highs) + len(lows) == len(row)
     nums = []
     for high, low in zip(highs, lows):
-      nums.append(hex((high << 8) + low))
-    real += ", ".join(nums)
+      nums.append((high << 8) + low)
+    rows.append(nums)
+  return rows
+
+
+def write_pixels(info, rows):
+  filename = info[0]
+  real = ''
+  for nums in rows:
+    real += ", ".join(hex(num) for num in nums)
     real += ",\n"
-  
 
   contents = real
   print(f'{len(contents)=}')
@@ -30,9 +43,49 @@ def read_bmp(info):
     outf.write(contents)
 
 
+# The board is mostly long runs of one color, and most rows are the same.
+# Every distinct row is stored once as (length, color) pairs in <name>_runs.txt,
+# <name>_rows.txt holds the index of the first pair for every row.
+def write_compressed(info, rows):
+  filename = info[0]
+  runs = []
+  row_starts = []
+  seen = {}
+  for nums in rows:
+    key = tuple(nums)
+    if key not in seen:
+      seen[key] = len(runs)
+      start = 0
+      for i in range(1, len(nums) + 1):
+        if i == len(nums) or nums[i] != nums[start]:
+          runs.append((i - start, nums[start]))
+          start = i
+    row_starts.append(seen[key])
+
+  # indices count uint16_t values, two per run
+  assert 2 * len(runs) <= 0xffff
+  with open(filename[:-4] + '_runs.txt', 'w') as outf:
+    for length, color in runs:
+      outf.write(f'{length}, {hex(color)},\n')
+  with open(filename[:-4] + '_rows.txt', 'w') as outf:
+    outf.write(", ".join(str(2 * start) for start in row_starts))
+    outf.write(",\n")
+
+  raw = 2 * sum(len(nums) for nums in rows)
+  compressed = 2 * (2 * len(runs) + len(row_starts))
+  print(f'{filename}: {len(seen)} distinct rows, {len(runs)} runs, '
+        f'{compressed} bytes of flash instead of {raw}')
+
+
 def main():
-  for fname in [board, note]:
-    read_bmp(fname)
+  write_compressed(board, read_bmp(board))
+  for pixels, alpha in sheets:
+    assert pixels or alpha
+    if pixels and alpha:
+      assert pixels[1:] == alpha[1:], 'the alpha has to be the size of the sheet'
+    for info in (pixels, alpha):
+      if info:
+        write_pixels(info, read_bmp(info))
 
 if __name__ == "__main__":
   main()
@@ -4,7 +4,7 @@
 
 #include "lib/include/keyboard.h"
 #include "lib/include/lcd.h"
-#include "lib/include/dma_uart.h"
+#include "lib/include/trace.h"
 #include "game.h"
 #include "speaker.h"
 
@@ -32,40 +32,131 @@ static void helperPrintInt64(char start[], int64_t to_print, int space) {
 // to the internal format when indexing GameState arrays
 #define COL (col - 1)
 
-#define MAX_NOTES_IN_COL 32
-#define NOTE_INIT_Y (-30)
-
-typedef uint64_t tick_t;
-
-// information on how notes should be spawned and played
+// notes appear this high above the screen
+#define SPAWN_Y (-100)
+// and reach the fret this many ticks after their start time,
+// at the default speed of one pixel per tick
+#define LEAD_TICKS (FRET_PRESS_Y - SPAWN_Y - 1)
+
+// How far from its arrival a note can be pressed (after the latency offset).
+// Presses within the miss window but outside the good one take the note as a miss.
+#define PERFECT_WINDOW TICKS(5) // 50 ms
+#define GOOD_WINDOW TICKS(12)
+#define MISS_WINDOW TICKS(23) // as far as the old pixel window reached at the default speed
+
+#define PERFECT_SCORE 1000
+#define GOOD_SCORE 500
+#define MISS_SCORE (-100) // also for the notes which leave the screen
+
+#define MAX_LATENCY TICKS(25)
+
+// Notes at least this long are hold notes: once the head is hit, the fret is
+// held while the tail passes it, for HOLD_SCORE every tick of it.
+#define MIN_HOLD TICKS(50)
+#define HOLD_SCORE 10
+
+// Notes on the screen at once are at most this many notes of the chart apart
+// (spawning waits for that otherwise). A power of two, so that the note
+// queues and the decoded notes can wrap with a mask.
+#define LIVE_NOTES 128
+// lcd.c keeps track of all of them
+static_assert(LIVE_NOTES <= LCD_COLUMN_NOTES, "the LCD has to remember every note of a column");
+
+// a decoded note of the chart
 typedef struct {
-  const int column; // the column of the note
-  const tick_t start_time; // the number of ticks since start
-  const Note note;
-  const int duration;
+  songtime_t start;
+  int32_t duration;
+  Note note;
+  uint8_t column;
 } NoteInfo;
 
 void spawnNoteY(const NoteInfo* info, int y);
 
+typedef enum {
+  NOTE_FALLING,
+  NOTE_HELD, // a hold note whose head was hit, its fret is still held
+  NOTE_DROPPED, // released before the end of its tail, which falls on
+} NoteState;
+
 // concrete note that is already spawned
 typedef struct {
-  int pos_y;
-  const NoteInfo* info;  
+  int16_t pos_y;
+  uint16_t song_index; // wraps around, only its low bits pick the NoteInfo
+  int16_t cut; // rows of the tail played, once the head was hit
+  NoteState state;
 } SpawnedNote;
 
-
+// Ring buffer of the notes alive in a column, in the order they were spawned.
+// All notes move together, so that is also bottom to top: the oldest notes
+// are the first to reach the fret and to leave the screen.
+typedef struct {
+  SpawnedNote notes[LIVE_NOTES];
+  unsigned int head; // the oldest note
+  unsigned int count;
+  bool holding; // a note, NOTE_HELD
+  songtime_t held_until; // it has been scored up to
+} NoteQueue;
+
+// i-th note of the queue, counting from the oldest
+#define QUEUE_AT(_queue, _i) ((_queue)->notes[((_queue)->head + (_i)) & (LIVE_NOTES - 1)])
+
+// Notes are placed by song time: a note is scroll speed times the time left
+// until it reaches the fret above the fret. To move all notes by the same
+// whole number of pixels, both the notes and the board keep their position
+// along the way down ("travel") in whole pixels, a note's y is the difference.
 struct GameState {
-  SpawnedNote notes[N_COLS][MAX_NOTES_IN_COL];
-  unsigned int note_buf_state[N_COLS];
+  NoteQueue columns[N_COLS];
   uint64_t score;
   int spawned;
-  tick_t ticks;
-} state;
+  NoteInfo decoded[LIVE_NOTES]; // the last notes read from the chart
+  songtime_t time;
+  // the clock given to handleTime, song time is offset from it by seeks
+  songtime_t clock;
+  songtime_t offset;
+  songtime_t loop_start, loop_end; // no loop if they're equal
+  int speed; // pixels per tick, SPEED_FRAC_BITS fractional bits
+  songtime_t latency; // of the presses, set by the player
+  int64_t travel; // of the board at time
+} state = {.speed = DEFAULT_SPEED};
+
+static int64_t travelAt(songtime_t time) {
+  return (time * state.speed) >> (TIME_FRAC_BITS + SPEED_FRAC_BITS);
+}
 
-#define GET_LOWEST_FREE(_col) ({ \
-    unsigned int st = state.note_buf_state[_col]; \
-    st == 0 ? 0 : 32 - __builtin_clz(st); \
-  })
+static songtime_t arrivalTime(const NoteInfo* info) {
+  return info->start + TICKS(LEAD_TICKS);
+}
+
+static int noteY(const NoteInfo* info, int64_t board_travel) {
+  return FRET_PRESS_Y + board_travel - travelAt(arrivalTime(info));
+}
+
+static const NoteInfo* noteInfo(const SpawnedNote* note) {
+  return &state.decoded[note->song_index & (LIVE_NOTES - 1)];
+}
+
+static bool isHold(const NoteInfo* info) {
+  return info->duration >= MIN_HOLD;
+}
+
+// the tail reaches the fret when the note ends
+static int tailLength(const NoteInfo* info) {
+  if (!isHold(info)) {
+    return 0;
+  }
+  songtime_t arrival = arrivalTime(info);
+  return travelAt(arrival + info->duration) - travelAt(arrival);
+}
+
+// how the note is drawn: a held tail ends on the fret, a dropped one
+// where it was released
+static LcdNote lcdNote(const SpawnedNote* note) {
+  int tail = tailLength(noteInfo(note));
+  if (note->state == NOTE_FALLING) {
+    return (LcdNote){note->pos_y, tail, true};
+  }
+  return (LcdNote){note->pos_y - note->cut, tail - note->cut, false};
+}
 
 void updateScore() {
   const int offset = sizeof("Score: ") - 1;
@@ -73,177 +164,684 @@ void updateScore() {
   int size = width + offset;
   
   const char score[] = "Score: ";
-  char buf[size];
+  char buf[size + 1];
   memcpy(buf, score, offset);
   char* digits = buf + offset;
 
   memset(digits, ' ', width);
   helperPrintInt64(digits, state.score, width);
+  buf[size] = '\0';
 
+  // only the digits which changed are sent to the screen
   LCDgoto(0, 0);
-  for (int i = 0; i < size; ++i) {
-    LCDputchar(buf[i]);
-  }
+  LCDputString(buf);
 }
 
+// Drawing which can wait for drawPending: the columns whose notes were spawned
+// or moved since they were last drawn, and the score. However many times they
+// changed in between, they are drawn once, as they are by then.
+struct PendingDrawing {
+  bool columns[N_COLS];
+  int moved[N_COLS]; // pixels, since the column was last drawn
+  bool score;
+  int next; // the piece to look at first, so that none is left waiting
+} pending;
+
+// the columns, then the score
+#define PIECES (N_COLS + 1)
+
 void changeScoreBy(int delta) {
   if (delta < 0 && state.score < (uint64_t)-delta) {
     state.score = 0;
   } else {
     state.score += delta;
   }
-  updateScore();
+  pending.score = true;
 }
 
+// redraws all notes of the column, wherever they were drawn before
+static void drawColumn(int col) {
+  NoteQueue* queue = &state.columns[COL];
+  LcdNote notes[queue->count + 1]; // no zero-length arrays
+  for (unsigned int i = 0; i < queue->count; ++i) {
+    notes[i] = lcdNote(&QUEUE_AT(queue, i));
+  }
+  LCDdrawColumn(col, notes, queue->count, pending.moved[COL]);
+  pending.columns[COL] = false;
+  pending.moved[COL] = 0;
+}
 
-const int to_spawn = 193; // This value to be manually copied from the comment in song.txt
+// before notes are removed from the screen, they have to be where the game thinks they are
+static void catchUp(int col) {
+  if (pending.columns[COL]) {
+    drawColumn(col);
+  }
+}
 
-// must be ordered by start_time
-const NoteInfo song[256] = {
-#include "song.txt"
+bool isDrawingPending() {
+  for (int i = 0; i < N_COLS; ++i) {
+    if (pending.columns[i]) {
+      return true;
+    }
+  }
+  return pending.score;
+}
+
+bool drawPending() {
+  for (int i = 0; i < PIECES; ++i) {
+    int piece = (pending.next + i) % PIECES;
+    if (piece < N_COLS && pending.columns[piece]) {
+      drawColumn(piece + 1);
+    } else if (piece == N_COLS && pending.score) {
+      pending.score = false;
+      updateScore();
+    } else {
+      continue;
+    }
+    pending.next = (piece + 1) % PIECES;
+    return true;
+  }
+  return false;
+}
+
+
+// Every song, packed by compile_chart.py, which also describes the format.
+// Charts are read in place, selecting one only points the reader at it.
+static const uint8_t library[] __attribute__((section(".rodata.songs"))) = {
+#include "songs.txt"
 };
 
-// spawns all notes which haven't been spawned since last tick
-void spawnNotesForTick(tick_t tick) {
-  while (song[state.spawned].start_time <= tick && state.spawned < to_spawn) {
-    int64_t noteY = song[state.spawned].start_time - tick - 100;
-    char msg[128] = "Spawning note with start time ............ during tick ............ at y = ............\n";
-
-// helperPrintInt64 isn't easily optimized out or inlined, so this trick optimizes it away regardless.
-#ifndef NDEBUG
-    helperPrintInt64(msg + sizeof("Spawning note with start time ") - 1, song[state.spawned].start_time, 12);
-    helperPrintInt64(msg + sizeof("Spawning note with start time ............ during tick ") - 1, tick, 12);
-    helperPrintInt64(msg + sizeof("Spawning note with start time ............ during tick ............ at y = ") - 1, noteY, 12);
-#endif
-
-    dmaSendWithCopy(msg, 128);
-    
-    spawnNoteY(&song[state.spawned], noteY);
-    state.spawned++;
-    
+#define INDEX_ENTRY_SIZE 32
+#define TITLE_SIZE 22
+#define CHECKPOINT_SIZE 20
+
+static uint32_t readVarint(const uint8_t** bytes) {
+  uint32_t value = 0;
+  for (int shift = 0; ; shift += 7) {
+    uint8_t byte = *(*bytes)++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
   }
 }
 
-void spawnNoteY(const NoteInfo* info, int y) {
-  int col = info->column;
-  unsigned int lowest_free = GET_LOWEST_FREE(COL);
-  if (lowest_free == 32) {
-    for (int i = 0; i < MAX_NOTES_IN_COL; ++i) {
-      if (!(state.note_buf_state[COL] & (1 << i))) {
-        lowest_free = i;
-        break;
-      }
+static uint32_t readU32(const uint8_t** bytes) {
+  const uint8_t* b = *bytes;
+  *bytes += 4;
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint16_t readU16(const uint8_t** bytes) {
+  const uint8_t* b = *bytes;
+  *bytes += 2;
+  return b[0] | b[1] << 8;
+}
+
+static const uint8_t* indexEntry(int song) {
+  return library + 1 + song * INDEX_ENTRY_SIZE;
+}
+
+int getSongCount() {
+  return library[0];
+}
+
+SongInfo getSongInfo(int song) {
+  const uint8_t* bytes = indexEntry(song) + 4;
+  SongInfo info;
+  info.length = TICKS(readU32(&bytes));
+  info.note_count = readU16(&bytes);
+  info.title = (const char*)bytes;
+  return info;
+}
+
+// the selected song's chart
+static const uint8_t* chart;
+static int selected_song;
+
+// Reads the chart one note at a time, straight from flash.
+struct ChartReader {
+  const uint8_t* next_note;
+  const uint8_t* next_tempo; // the change after the current one
+  int tempo_left; // changes after the current one
+  uint32_t tempo_division; // where the next change is
+  uint32_t per_division; // song time, at the current tempo
+  uint32_t division; // of the last note
+  songtime_t time; // of the last note
+  uint32_t length; // in divisions, of the last note
+  int note_count;
+  // checkpoints for seeking, see compile_chart.py
+  const uint8_t* checkpoints;
+  int checkpoint_step;
+} reader;
+
+// divisions from the current tempo change to the next one
+static uint32_t nextTempoDelta() {
+  const uint8_t* peek = reader.next_tempo;
+  return readVarint(&peek);
+}
+
+static void rewindChart() {
+  const uint8_t* bytes = chart;
+  reader.note_count = bytes[0] | bytes[1] << 8;
+  reader.tempo_left = bytes[2] - 1;
+  bytes += 3;
+  readVarint(&bytes); // the first change is at 0
+  reader.per_division = readU32(&bytes);
+  reader.next_tempo = bytes;
+  for (int i = 0; i < reader.tempo_left; ++i) {
+    readVarint(&bytes);
+    readU32(&bytes);
+  }
+  reader.checkpoint_step = *bytes++;
+  reader.checkpoints = bytes;
+  int checkpoint_count = (reader.note_count + reader.checkpoint_step - 1) / reader.checkpoint_step;
+  reader.next_note = bytes + checkpoint_count * CHECKPOINT_SIZE;
+  reader.tempo_division = reader.tempo_left > 0 ? nextTempoDelta() : 0;
+  reader.division = 0;
+  reader.time = 0;
+  reader.length = 0;
+}
+
+// advances the last note's time by delta divisions, through tempo changes
+static void advanceChart(uint32_t delta) {
+  while (reader.tempo_left > 0 && reader.division + delta >= reader.tempo_division) {
+    uint32_t before_change = reader.tempo_division - reader.division;
+    reader.time += (songtime_t)before_change * reader.per_division;
+    reader.division = reader.tempo_division;
+    delta -= before_change;
+    const uint8_t* bytes = reader.next_tempo;
+    readVarint(&bytes);
+    reader.per_division = readU32(&bytes);
+    reader.next_tempo = bytes;
+    if (--reader.tempo_left > 0) {
+      reader.tempo_division += nextTempoDelta();
     }
-    if (lowest_free == 32) {
-      DMA_DBG("NOTE NOT SPAWNED!!!\n");
-      return;
+  }
+  reader.time += (songtime_t)delta * reader.per_division;
+  reader.division += delta;
+}
+
+static void readNote(NoteInfo* info) {
+  uint32_t head = readVarint(&reader.next_note);
+  uint8_t pitch = *reader.next_note++;
+  if (head & 0x8) {
+    reader.length = readVarint(&reader.next_note);
+  }
+  advanceChart(head >> 4);
+  info->start = reader.time;
+  info->duration = reader.length * reader.per_division;
+  info->note = (Note){.letter = pitch % 12 + 1, .octave = pitch / 12};
+  info->column = (head & 0x7) + 1;
+}
+
+// song time of the note at a checkpoint
+static songtime_t checkpointStart(int checkpoint) {
+  const uint8_t* bytes = reader.checkpoints + checkpoint * CHECKPOINT_SIZE + 12;
+  uint32_t low = readU32(&bytes);
+  return (songtime_t)((uint64_t)readU32(&bytes) << 32 | low);
+}
+
+// Reads the first note starting at start or later into info (with a binary
+// search over the chart's checkpoints, then at most a step of notes from the
+// closest one), returns its index, or the number of notes if there's no such note.
+static int findNote(songtime_t start, NoteInfo* info) {
+  rewindChart();
+  if (reader.note_count == 0) {
+    return 0;
+  }
+  int count = (reader.note_count + reader.checkpoint_step - 1) / reader.checkpoint_step;
+  int low = 0, high = count; // the checkpoint is in [low, high)
+  while (high - low > 1) {
+    int middle = (low + high) / 2;
+    if (checkpointStart(middle) < start) {
+      low = middle;
+    } else {
+      high = middle;
     }
   }
-  state.notes[COL][lowest_free].pos_y = y;
-  state.notes[COL][lowest_free].info = info;
-  state.note_buf_state[COL] |= 1 << lowest_free;
-  
-  char msg[] = "Note __ spawned in column _\n";
-  msg[sizeof("Note _") - 1] = '0' + lowest_free % 10;
-  msg[sizeof("Note ") - 1] = '0' + lowest_free / 10 % 10;
-  msg[sizeof("Note __ spawned in column ") - 1] = '0' + col;
-  
-  dmaSendWithCopy(msg, sizeof(msg));
+  // the song time and tempo at the checkpoint come from the tempo map
+  const uint8_t* bytes = reader.checkpoints + low * CHECKPOINT_SIZE;
+  reader.next_note = chart + readU32(&bytes);
+  advanceChart(readU32(&bytes));
+  reader.length = readU32(&bytes);
+
+  int index = low * reader.checkpoint_step;
+  for (; index < reader.note_count; ++index) {
+    readNote(info);
+    if (info->start >= start) {
+      break;
+    }
+  }
+  return index;
 }
 
-typedef void (*NoteHandler)(int col, int i);
+// the next note to spawn, decoded but not spawned yet
+static const NoteInfo* upcoming() {
+  return &state.decoded[state.spawned & (LIVE_NOTES - 1)];
+}
 
-void noteHelper(NoteHandler handler) {
-  for (int col = 0; col < N_COLS; ++col) {
-    for (int i = 0; i < MAX_NOTES_IN_COL; ++i) {
-      handler(col + 1, i);
+// decoded notes in use, from the oldest one on the screen to the upcoming one
+static int liveNotes() {
+  int live = 1;
+  for (int col = 1; col <= N_COLS; ++col) {
+    NoteQueue* queue = &state.columns[COL];
+    if (queue->count > 0) {
+      int age = (uint16_t)(state.spawned - QUEUE_AT(queue, 0).song_index) + 1;
+      live = age > live ? age : live;
     }
   }
+  return live;
+}
+
+// Spawns all notes which would be below SPAWN_Y once the board travels to
+// board_travel. They are placed where they'd be now, before the move there:
+// notes spawned late have already come down a bit, like they would have.
+void spawnNotes(int64_t board_travel) {
+  while (state.spawned < reader.note_count
+         && noteY(upcoming(), board_travel) > SPAWN_Y && liveNotes() < LIVE_NOTES) {
+    int64_t y = noteY(upcoming(), state.travel);
+    spawnNoteY(upcoming(), y);
+    state.spawned++;
+    if (state.spawned < reader.note_count) {
+      readNote(&state.decoded[state.spawned & (LIVE_NOTES - 1)]);
+    }
+  }
+}
+
+void spawnNoteY(const NoteInfo* info, int y) {
+  int col = info->column;
+  NoteQueue* queue = &state.columns[COL];
+  SpawnedNote* note = &QUEUE_AT(queue, queue->count);
+  note->pos_y = y;
+  note->song_index = state.spawned;
+  note->cut = 0;
+  note->state = NOTE_FALLING;
+  queue->count++;
+  pending.columns[COL] = true;
+  trace(TR_SPAWN, col, note->song_index);
+}
+
+// tail included
+static bool belowScreen(const SpawnedNote* note) {
+  LcdNote drawn = lcdNote(note);
+  return drawn.y - (drawn.tail > 0 ? drawn.tail : 0) > LCD_PIXEL_HEIGHT + 1;
 }
 
 void moveNotes(int how_many) {
-  void lambda(int col, int i) {
-    if (state.note_buf_state[COL] & (1 << i)) {
-      int y = state.notes[COL][i].pos_y;
-      if (y > LCD_PIXEL_HEIGHT + 1) {
-        deleteNote(col, i);
-        changeScoreBy(-100);
-      } else {
-        LCDmoveNoteVertical(col, y, how_many);
-        state.notes[COL][i].pos_y += how_many;
+  // in scroll mode this moves everything at once, drawing the columns
+  // only redraws what the scroll couldn't
+  LCDscrollBoard(how_many);
+
+  // every column is redrawn in one go (by drawPending), so notes close
+  // to each other don't redraw each other's rows
+  for (int col = 1; col <= N_COLS; ++col) {
+    NoteQueue* queue = &state.columns[COL];
+    // the oldest notes are the lowest ones
+    while (queue->count > 0 && belowScreen(&QUEUE_AT(queue, 0))) {
+      bool missed = QUEUE_AT(queue, 0).state == NOTE_FALLING;
+      deleteNote(col, 0);
+      if (missed) {
+        changeScoreBy(MISS_SCORE);
+      }
+    }
+    for (unsigned int i = 0; i < queue->count; ++i) {
+      SpawnedNote* note = &QUEUE_AT(queue, i);
+      note->pos_y += how_many;
+      if (note->state == NOTE_HELD) {
+        note->cut += how_many; // the tail stays on the fret
       }
     }
-  } // lambda
-  noteHelper(lambda);
+    pending.columns[COL] = true;
+    pending.moved[COL] += how_many;
+  }
 }
 
+// i counts from the oldest note of the column, the ones older than it
+// (there are few, they are the lowest) move up to fill its place
 void deleteNote(int col, int i) {
-  LCDremoveNote(col, state.notes[COL][i].pos_y);
-  state.note_buf_state[COL] &= ~(1 << i);
+  catchUp(col);
+  NoteQueue* queue = &state.columns[COL];
+  SpawnedNote deleted = QUEUE_AT(queue, i);
+  LCDremoveNote(col, lcdNote(&deleted).y);
+  for (; i > 0; --i) {
+    QUEUE_AT(queue, i) = QUEUE_AT(queue, i - 1);
+  }
+  queue->head = (queue->head + 1) & (LIVE_NOTES - 1);
+  queue->count--;
+  trace(TR_DELETE, col, deleted.song_index);
+}
 
-  char msg[] = "Note __ deleted in column _\n";
-  msg[sizeof("Note _") - 1] = '0' + i % 10;
-  msg[sizeof("Note ") - 1] = '0' + i / 10 % 10;
-  msg[sizeof("Note __ deleted in column ") - 1] = '0' + col;
-  
-  dmaSendWithCopy(msg, sizeof(msg));
+songtime_t when_speaker_off = 0;
+
+// the held note of the column, NULL if there's none
+static SpawnedNote* heldNote(int col, unsigned int* index) {
+  NoteQueue* queue = &state.columns[COL];
+  if (!queue->holding) {
+    return NULL;
+  }
+  for (unsigned int i = 0; i < queue->count; ++i) {
+    if (QUEUE_AT(queue, i).state == NOTE_HELD) {
+      *index = i;
+      return &QUEUE_AT(queue, i);
+    }
+  }
+  queue->holding = false;
+  return NULL;
 }
 
-#define IABS(x) ({ \
-  int val = x; \
-  val < 0 ? -val : val; \
-})
+// Scores the held note of the column up to time, it's gone once its whole
+// tail was held. Points are counted from the arrival every time, so that
+// the steps don't lose their fractions.
+static void scoreHold(int col, songtime_t time) {
+  unsigned int i;
+  SpawnedNote* note = heldNote(col, &i);
+  if (!note) {
+    return;
+  }
+  NoteQueue* queue = &state.columns[COL];
+  const NoteInfo* info = noteInfo(note);
+  songtime_t arrival = arrivalTime(info);
+  songtime_t end = arrival + info->duration;
+  if (time > end) {
+    time = end;
+  }
+  if (time > queue->held_until) {
+    int64_t before = ((queue->held_until - arrival) * HOLD_SCORE) >> TIME_FRAC_BITS;
+    int64_t after = ((time - arrival) * HOLD_SCORE) >> TIME_FRAC_BITS;
+    changeScoreBy(after - before);
+    queue->held_until = time;
+  }
+  if (time == end) {
+    queue->holding = false;
+    trace(TR_HOLD, col, (end - arrival) >> TIME_FRAC_BITS);
+    deleteNote(col, i);
+  }
+}
 
-const int hit_window = 23; // determined by trial and error
+// the rest of the tail falls on without scoring
+static void dropHold(int col) {
+  scoreHold(col, state.time);
+  unsigned int i;
+  SpawnedNote* note = heldNote(col, &i);
+  if (!note) {
+    return;
+  }
+  NoteQueue* queue = &state.columns[COL];
+  const NoteInfo* info = noteInfo(note);
+  note->state = NOTE_DROPPED;
+  queue->holding = false;
+  trace(TR_HOLD, col, (queue->held_until - arrivalTime(info)) >> TIME_FRAC_BITS);
+  // unless another note is playing by now
+  if (when_speaker_off == arrivalTime(info) + info->duration) {
+    speakerOff();
+  }
+}
 
-tick_t when_speaker_off = 0;
+// The head of a hold note was hit, its tail is left and ends on the fret.
+// The tail is drawn as it is, only its end stops moving.
+static void holdNote(int col, int i) {
+  dropHold(col);
+  catchUp(col);
+  NoteQueue* queue = &state.columns[COL];
+  SpawnedNote* note = &QUEUE_AT(queue, i);
+  int drawn_y = note->pos_y;
+  note->state = NOTE_HELD;
+  note->cut = note->pos_y - FRET_PRESS_Y;
+  LCDreplaceNote(col, drawn_y, lcdNote(note));
+  queue->holding = true;
+  queue->held_until = arrivalTime(noteInfo(note));
+}
 
-void handleFretPress(int col) {
+// Judged by the song time of the press, not by where the note is drawn
+// when the main loop gets to it, so a late loop doesn't change anything.
+void handleFretPress(int col, songtime_t at) {
   LCDpressFret(col);
-  for (int i = 0; i < MAX_NOTES_IN_COL; ++i) {
-    if (state.note_buf_state[COL] & (1 << i)) {
-      int y = state.notes[COL][i].pos_y;
-      int difference = IABS(y - FRET_PRESS_Y);
-      if (difference < hit_window) {
-        DMA_DBG("Detected fret/note collision!\n");
-        deleteNote(col, i);
-        changeScoreBy(1000 - difference);
-        const NoteInfo* info = state.notes[COL][i].info;
-        setNote(info->note);
-        speakerOn();
-        when_speaker_off = state.ticks + info->duration + FRET_PRESS_Y - y;
-      }
+  at += state.offset - state.latency;
+  NoteQueue* queue = &state.columns[COL];
+  // notes arrive in the order they were spawned, the first one close enough
+  // is pressed, stop at the first one which is too far in the future
+  for (unsigned int i = 0; i < queue->count; ++i) {
+    if (QUEUE_AT(queue, i).state != NOTE_FALLING) {
+      continue; // only the tail is left
+    }
+    const NoteInfo* info = noteInfo(&QUEUE_AT(queue, i));
+    songtime_t error = at - arrivalTime(info);
+    if (error > MISS_WINDOW) {
+      continue;
+    }
+    if (error < -MISS_WINDOW) {
+      break;
     }
+    int16_t error_ms = (error * 10) >> TIME_FRAC_BITS; // a tick is 10 ms
+    if (error < -GOOD_WINDOW || error > GOOD_WINDOW) {
+      deleteNote(col, i);
+      trace(TR_MISS, col, error_ms);
+      changeScoreBy(MISS_SCORE);
+      return;
+    }
+    if (isHold(info)) {
+      holdNote(col, i);
+    } else {
+      deleteNote(col, i);
+    }
+    if (error < -PERFECT_WINDOW || error > PERFECT_WINDOW) {
+      trace(TR_GOOD, col, error_ms);
+      changeScoreBy(GOOD_SCORE);
+    } else {
+      trace(TR_PERFECT, col, error_ms);
+      changeScoreBy(PERFECT_SCORE);
+    }
+    setNote(info->note);
+    speakerOn();
+    when_speaker_off = arrivalTime(info) + info->duration;
+    return;
   }
 }
 
 void handleFretRelease(int col) {
   LCDreleaseFret(col);
+  dropHold(col);
 }
 
 
-void handleTicks(uint32_t how_many_ticks) {
-  state.ticks += how_many_ticks;
-  spawnNotesForTick(state.ticks);
-  moveNotes(how_many_ticks);
+void handleTime(songtime_t clock) {
+  state.clock = clock;
+  songtime_t now = clock + state.offset;
+  if (state.loop_end > state.loop_start && now >= state.loop_end) {
+    seekTo(state.loop_start);
+    return;
+  }
+  if (now <= state.time) {
+    return;
+  }
+  setTraceTick(now >> TIME_FRAC_BITS);
+  int64_t travel = travelAt(now);
+  spawnNotes(travel);
+  state.time = now;
+  // a slow frame only makes a bigger step
+  if (travel != state.travel) {
+    int how_many = travel - state.travel;
+    state.travel = travel;
+    moveNotes(how_many);
+  }
+  for (int col = 1; col <= N_COLS; ++col) {
+    scoreHold(col, state.time);
+  }
 
-  if (state.ticks > when_speaker_off) {
+  if (state.time > when_speaker_off) {
     speakerOff();
   }
 }
 
+void setScrollSpeed(int speed) {
+  if (speed < MIN_SPEED) {
+    speed = MIN_SPEED;
+  } else if (speed > MAX_SPEED) {
+    speed = MAX_SPEED;
+  }
+  // the notes keep their times, so every note jumps to another place
+  state.speed = speed;
+  state.travel = travelAt(state.time);
+  for (int col = 1; col <= N_COLS; ++col) {
+    catchUp(col);
+    NoteQueue* queue = &state.columns[COL];
+    for (unsigned int i = 0; i < queue->count; ++i) {
+      SpawnedNote* note = &QUEUE_AT(queue, i);
+      LCDremoveNote(col, lcdNote(note).y);
+      int old_y = note->pos_y;
+      note->pos_y = noteY(noteInfo(note), state.travel);
+      if (note->state == NOTE_HELD) {
+        note->cut += note->pos_y - old_y;
+      }
+    }
+    pending.columns[COL] = true;
+  }
+}
+
+int getScrollSpeed() {
+  return state.speed;
+}
+
+void setLatencyOffset(songtime_t latency) {
+  if (latency < -MAX_LATENCY) {
+    latency = -MAX_LATENCY;
+  } else if (latency > MAX_LATENCY) {
+    latency = MAX_LATENCY;
+  }
+  state.latency = latency;
+}
+
+songtime_t getLatencyOffset() {
+  return state.latency;
+}
+
+uint64_t getScore() {
+  return state.score;
+}
+
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t size) {
+  const uint8_t* bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u; // FNV-1a
+  }
+  return hash;
+}
+
+#define HASH(_hash, _value) hashBytes(_hash, &(_value), sizeof(_value))
+
+uint32_t getGameDigest() {
+  uint32_t hash = 2166136261u;
+  hash = HASH(hash, state.score);
+  hash = HASH(hash, state.spawned);
+  hash = HASH(hash, state.time);
+  hash = HASH(hash, state.offset);
+  hash = HASH(hash, state.travel);
+  for (int col = 1; col <= N_COLS; ++col) {
+    const NoteQueue* queue = &state.columns[COL];
+    hash = HASH(hash, queue->count);
+    hash = HASH(hash, queue->holding);
+    // field by field, the padding isn't part of the state
+    for (unsigned int i = 0; i < queue->count; ++i) {
+      const SpawnedNote* note = &QUEUE_AT(queue, i);
+      hash = HASH(hash, note->pos_y);
+      hash = HASH(hash, note->song_index);
+      hash = HASH(hash, note->cut);
+      hash = HASH(hash, note->state);
+    }
+  }
+  return hash;
+}
+
+bool isSongOver() {
+  if (state.spawned < reader.note_count) {
+    return false;
+  }
+  for (int col = 1; col <= N_COLS; ++col) {
+    if (state.columns[COL].count > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void clearNotes() {
+  for (int col = 1; col <= N_COLS; ++col) {
+    while (state.columns[COL].count > 0) {
+      deleteNote(col, 0);
+    }
+    state.columns[COL].holding = false;
+  }
+}
+
+// The notes which haven't reached the fret at time are spawned at once, in
+// their places, the ones before them are skipped without being read.
+void seekTo(songtime_t time) {
+  if (time < 0) {
+    time = 0;
+  }
+  clearNotes();
+  speakerOff();
+  state.offset = time - state.clock;
+  state.time = time;
+  state.travel = travelAt(time);
+  setTraceTick(time >> TIME_FRAC_BITS);
+
+  NoteInfo info;
+  // the first note which starts after time - TICKS(LEAD_TICKS)
+  state.spawned = findNote(time - TICKS(LEAD_TICKS) + 1, &info);
+  if (state.spawned < reader.note_count) {
+    state.decoded[state.spawned & (LIVE_NOTES - 1)] = info;
+  }
+  spawnNotes(state.travel);
+}
+
+songtime_t getSongTime() {
+  return state.time;
+}
+
+void setLoop(songtime_t start, songtime_t end) {
+  state.loop_start = start < 0 ? 0 : start;
+  state.loop_end = end;
+}
+
+void selectSong(int song) {
+  if (song < 0 || song >= getSongCount()) {
+    return;
+  }
+  selected_song = song;
+  // the old song's notes are removed as they were decoded from its chart
+  clearNotes();
+  const uint8_t* bytes = indexEntry(song);
+  chart = library + readU32(&bytes);
+  resetGame();
+}
+
+int getSelectedSong() {
+  return selected_song;
+}
+
 void resetGame() {
-  state.ticks = 0;
+  // while the notes are still drawn as they were decoded, at the old time
+  clearNotes();
+  if (!chart) {
+    // the first song until another one is selected
+    const uint8_t* bytes = indexEntry(0);
+    chart = library + readU32(&bytes);
+  }
+  state.time = 0;
+  state.clock = 0;
+  state.offset = 0;
+  state.loop_start = state.loop_end = 0;
+  setTraceTick(0);
+  state.travel = 0;
   state.spawned = 0;
+  rewindChart();
+  if (reader.note_count > 0) {
+    readNote(&state.decoded[0]);
+  }
   state.score = 0;
+  pending.score = false;
   updateScore();
   speakerOff();
-
-  void deleterLambda(int col, int i) {
-    if (state.note_buf_state[COL] & (1 << i)) {
-      deleteNote(col, i);
-    }
-  }
-
-  noteHelper(deleterLambda);
-}
\ No newline at end of file
+}
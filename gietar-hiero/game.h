@@ -1,6 +1,7 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void updateScore();
@@ -8,11 +9,73 @@ void resetGame();
 // void spawnNote(int col);
 void deleteNote(int col, int i);
 void moveNotes(int how_many);
-void handleTicks(uint32_t how_many_ticks);
-void handleFretPress(int col);
+
+// The game logic only marks what has to be redrawn. This draws one piece of
+// it (the notes of a column or the score), so the main loop can spread the
+// drawing over its frames. Returns false if there was nothing to draw.
+bool drawPending();
+// true while drawPending has something left to draw
+bool isDrawingPending();
+
+// Song time in ticks (10 ms, the unit of song time in the charts),
+// with TIME_FRAC_BITS fractional bits.
+typedef int64_t songtime_t;
+
+#define TIME_FRAC_BITS 16
+#define TICKS(n) ((songtime_t)(n) << TIME_FRAC_BITS)
+
+// Moves the game forward to clock time now (counted from resetGame), which is
+// the song time unless the game seeked since.
+// However long it's been since the last call, the notes end up exactly where
+// they belong at that time, in one step.
+void handleTime(songtime_t now);
+
+// Jumps to a song time, back or forward: the board is rebuilt as it would be
+// then, without playing the song up to it. The clock keeps going, song time
+// goes on from time.
+void seekTo(songtime_t time);
+songtime_t getSongTime();
+// Once the song reaches end, it seeks back to start, for practicing a part of it.
+// Times are of the notes reaching the fret. setLoop(0, 0) stops looping,
+// so does resetGame.
+void setLoop(songtime_t start, songtime_t end);
+
+// Pixels per tick with SPEED_FRAC_BITS fractional bits. Notes reach the fret
+// at the same time at any speed, changing it moves them all to their new places.
+#define SPEED_FRAC_BITS 8
+#define DEFAULT_SPEED (1 << SPEED_FRAC_BITS)
+#define MIN_SPEED (DEFAULT_SPEED / 4)
+#define MAX_SPEED (DEFAULT_SPEED * 4)
+
+void setScrollSpeed(int speed);
+int getScrollSpeed();
+// every note has been spawned and is gone from the screen
+bool isSongOver();
+uint64_t getScore();
+// A hash of the score, the song time and every note on the board, two games
+// fed the same input have the same digest (see replay.h).
+uint32_t getGameDigest();
+// Presses are judged by how far they are from the notes' arrival, in song time.
+// at is the clock time of the press (which can be a bit in the past),
+// the latency offset is subtracted from it to make up for how late the screen
+// and the player are. It's set by the player and kept across resets.
+void handleFretPress(int col, songtime_t at);
+void setLatencyOffset(songtime_t latency);
+songtime_t getLatencyOffset();
 void handleFretRelease(int col);
 
-void increaseHitWindow();
-void decreaseHitWindow();
+// The song library, from songs.txt. A song is selected by pointing the chart
+// reader at it, the chart isn't copied, so switching is as quick as resetGame.
+typedef struct {
+  const char* title;
+  songtime_t length; // up to the end of the last note
+  int note_count;
+} SongInfo;
+
+int getSongCount();
+SongInfo getSongInfo(int song);
+// resets the game to the start of the song, the first one is selected at first
+void selectSong(int song);
+int getSelectedSong();
 
 #endif  // GAME_H
\ No newline at end of file
@@ -1,3 +1,10 @@
+import json
+import re
+
+# Charts count time in divisions of a beat, see compile_chart.py for the format.
+RESOLUTION = 48
+EIGHTH = RESOLUTION // 2
+
 
 def sweet_child_o_mine(out):
   # Sweet Child O' Mine by Guns N Roses is a really easy song to transcribe for this,
@@ -8,41 +15,80 @@ def sweet_child_o_mine(out):
   columns = '4324232'.join(str(i) for i in [1, 1, 2, 2, 3, 3, 1, 1]) + '4324232'
   letters = '2977969'.join(str(i) for i in [2, 2, 4, 4, 7, 7, 2, 2]) + '2977767'
   octaves = '4334343'.join(str(i) for i in [3, 3, 3, 3, 3, 3, 3, 3]) + '4334343'
-  duration = 30  
-  intervals = [duration] * len(columns)
+  # a bit shorter than an eighth, so that repeated notes can be heard
+  length = EIGHTH - 1
 
-  start = 10
+  start = 8
 
-  output_i = lambda i: f'  {{.column = {columns[i]}, .start_time = {start}, .note = {{.letter = {letters[i]}, .octave = {octaves[i]}}}, .duration = {duration - 1}}},\n'
+  output_i = lambda i: out({'at': start, 'column': int(columns[i]), 'letter': int(letters[i]),
+                            'octave': int(octaves[i]), 'length': length})
 
   for cutoff in [0, 0, 16]:
     for i in range(len(columns) - cutoff):
-      out(output_i(i))
-      start += intervals[i]
+      output_i(i)
+      start += EIGHTH
 
-  song_len = len(columns) * 3 - 16
   columns = '42321212324232123'
-  song_len += len(columns)
-  
   letters = '79694929496979692'
   octaves = '43' * (len(columns) // 2) + '4'
 
   for i in range(len(columns)):
     if i == len(columns) - 1:
       # last note is longer (1/2 note instead of 1/8)
-      duration *= 4
-    out(output_i(i))
-    start += intervals[i]
-  
+      length = 4 * EIGHTH - 1
+    output_i(i)
+    start += EIGHTH
+
 
+def scales(out):
+  # C major up and down two octaves, a column per pair of notes, the last
+  # one is held through the pause (a hold note), returns where each run
+  # starts, to speed them up
+  letters = [1, 3, 5, 6, 8, 10, 12] # C D E F G A B
+  up = [(octave, letter) for octave in [3, 4] for letter in letters] + [(5, 1)]
+  run = up + up[-2:0:-1]
+  start = 0
+  starts = []
+  for _ in range(3):
+    starts.append(start)
+    for i, (octave, letter) in enumerate(run):
+      length = 3 * EIGHTH - 1 if i == len(run) - 1 else EIGHTH - 1
+      out({'at': start, 'column': i // 2 % 4 + 1, 'letter': letter, 'octave': octave,
+           'length': length})
+      start += EIGHTH
+    start += 2 * EIGHTH
+  return starts
 
-  out(f'// {song_len} notes recorded')
+
+def write_chart(path, chart):
+  # one note per line
+  text = json.dumps(chart, indent=1)
+  text = re.sub(r'\{\n\s+([^{}]*?)\n\s+\}', lambda m: '{' + re.sub(r',\n\s+', ', ', m[1]) + '}', text)
+  with open(path, 'w') as f:
+    f.write(text + '\n')
+  print(f'{path}: {len(chart["notes"])} notes recorded')
 
 
 def main():
-  with open('song.txt', 'w') as f:
-    sweet_child_o_mine(f.write)
+  notes = []
+  sweet_child_o_mine(notes.append)
+  write_chart('song.json', {
+    'title': "Sweet Child O' Mine",
+    'resolution': RESOLUTION,
+    # an eighth is 30 ticks of 10 ms
+    'tempo': [{'at': 0, 'bpm': 100}],
+    'notes': notes,
+  })
+
+  notes = []
+  starts = scales(notes.append)
+  write_chart('scales.json', {
+    'title': 'C Major Scales',
+    'resolution': RESOLUTION,
+    'tempo': [{'at': at, 'bpm': bpm} for at, bpm in zip(starts, [90, 120, 150])],
+    'notes': notes,
+  })
 
 
 if __name__ == "__main__":
-  main()
\ No newline at end of file
+  main()
@@ -1,4 +1,3 @@
-#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -9,73 +8,200 @@
 
 #include "lib/include/keyboard.h"
 #include "lib/include/lcd.h"
+#include "lib/include/lcd_transport.h"
 
 #include "speaker.h"
 #include "game.h"
+#include "menu.h"
+#include "replay.h"
 
 // for debugging only
 #include "lib/include/dma_uart.h"
+#include "lib/include/trace.h"
 
 void initLcd() {
+#ifdef LCD_SPI_DMA
+  LCDsetTransport(&lcd_spi_transport);
+#endif
   LCDconfigure();
   LCDsetFont(&font8x16);
+#ifdef LCD_FRAMEBUFFER
+  LCDsetRetainedMode(true); // clears the screen
+#else
   LCDclear();
+#endif
   LCDgoto(0, 0);
 }
 
+// TIM5 (32 bits) counts freely, the game clock is read from it every loop.
+// One tick of song time is this many counts, 10 ms with the default clocks.
+#define COUNTS_PER_TICK 80000 // chosen by trial and error
+
 void initGameTimer() {
-  // enable timer2 timing
-  RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
   RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
 
-  TIM5->CR1 = TIM_CR1_URS; // counting up, interrupts only on overflow
+  TIM5->CR1 = 0; // counting up
   TIM5->PSC = 1;
-  TIM5->ARR = 80000; // chosen by trial and error
+  TIM5->ARR = 0xffffffff;
   TIM5->EGR = TIM_EGR_UG;
 
-  // enable interrupt
-  TIM5->SR = ~TIM_SR_UIF;
-  TIM5->DIER = TIM_DIER_UIE;
+  TIM5->CR1 |= TIM_CR1_CEN;
+}
 
-  NVIC_EnableIRQ(TIM5_IRQn);
+static void initCycleCounter() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
 
-  // enable timer
-  TIM5->CR1 |= TIM_CR1_CEN;
+static uint32_t readCycles() {
+  return DWT->CYCCNT;
+}
+
+// writes n right-aligned into the dots ending at end
+static inline void printUint(char* end, uint32_t n) {
+  do {
+    *--end = '0' + n % 10;
+    n /= 10;
+  } while (n && *(end - 1) == '.');
 }
 
 bool fall_on = false;
 
-atomic_int to_move = 0;
+// counts while the notes were falling, since the last reset
+uint64_t game_counts = 0;
+uint32_t last_count = 0;
 
-extern void TIM5_IRQHandler() {
-  uint32_t it_status = TIM5->SR & TIM5->DIER;
-  if (it_status & TIM_SR_UIF) {
-    TIM5->SR = ~TIM_SR_UIF;
+static uint32_t timerCount() {
+  return TIM5->CNT;
+}
 
-    if (fall_on) {
-      atomic_fetch_add(&to_move, 1);
-    }
+static songtime_t gameTime() {
+  uint32_t count = timerCount();
+  if (fall_on) {
+    game_counts += count - last_count; // wraps around correctly
   }
+  last_count = count;
+  return (game_counts << TIME_FRAC_BITS) / COUNTS_PER_TICK;
 }
 
-void loop() {
+// song time at an earlier count, since the last gameTime call
+// the notes were either falling all along or not at all
+// a key stamped after that call (while the earlier ones are handled) is taken
+// as pressed at it
+static songtime_t gameTimeAt(uint32_t count) {
+  int32_t age = (int32_t)(last_count - count); // wraps around correctly
+  if (age < 0) {
+    age = 0;
+  }
+  uint64_t counts = game_counts;
+  if (fall_on) {
+    counts = counts > (uint64_t)age ? counts - age : 0;
+  }
+  return (counts << TIME_FRAC_BITS) / COUNTS_PER_TICK;
+}
+
+#define SEEK_TICKS 500 // 5 s
+
+// marked with key 5
+songtime_t loop_start = 0;
+
+// The chart is read in place, switching only points the game at it (and
+// resets it), which should take well under a frame. Debug builds report how long.
+static void startSong(int song) {
+  uint32_t start = readCycles();
+  game_counts = 0;
+  loop_start = 0;
+  feedGame((ReplayEvent){.kind = RP_SONG, .a = song});
+  uint32_t cycles = readCycles() - start;
+  (void)cycles;
+
+#ifndef NDEBUG
+  char msg[] = "Song switched in ........ cycles\n";
+  printUint(msg + sizeof("Song switched in ........") - 1, cycles);
+  dmaSendWithCopy(msg, sizeof(msg) - 1);
+#endif
+}
+
+static void handleInput() {
   KbKey key;
+  uint32_t pressed_at;
+
+  // the presses are stamped by the keyboard interrupts
+  gameTime();
 
   // handle key press events
-  while ((key = getNext()) != KB_NOKEY) {
+  while ((key = getNextStamped(&pressed_at)) != KB_NOKEY) {
+    if (isMenuOpen()) {
+      int song = handleMenuKey(key);
+      if (song != MENU_OPEN) {
+        startSong(song);
+      }
+      continue;
+    }
+
     // 123A press frets
     // 7 resets song
     // * toggles note fall
+    // B and C speed the notes up and slow them down
+    // 4 and 6 move the latency offset, for presses which are judged early or late
+    // 5 marks the start of a loop, 8 its end (and goes back to the start), 9 stops looping
+    // 0 and # seek SEEK_TICKS back and forward
+    // D opens the song menu
     // others were previously used for debugging
 
     if (GET_ROW_NUM(key) == 1) { // Row 1; keys 1-4
       int col = GET_COL_NUM(key);
-      handleFretPress(col);
+      feedGame((ReplayEvent){.kind = RP_PRESS, .col = col, .a = gameTimeAt(pressed_at)});
     }
 
     if (key == KB_7) {
       DMA_DBG("Resetting...\n");
-      resetGame();
+      game_counts = 0;
+      loop_start = 0;
+      feedGame((ReplayEvent){.kind = RP_RESET});
+    }
+
+    if (key == KB_B) {
+      feedGame((ReplayEvent){.kind = RP_SPEED, .a = getScrollSpeed() + DEFAULT_SPEED / 8});
+    }
+
+    if (key == KB_C) {
+      feedGame((ReplayEvent){.kind = RP_SPEED, .a = getScrollSpeed() - DEFAULT_SPEED / 8});
+    }
+
+    if (key == KB_4) {
+      feedGame((ReplayEvent){.kind = RP_LATENCY, .a = getLatencyOffset() - TICKS(1)});
+    }
+
+    if (key == KB_6) {
+      feedGame((ReplayEvent){.kind = RP_LATENCY, .a = getLatencyOffset() + TICKS(1)});
+    }
+
+    if (key == KB_5) {
+      loop_start = getSongTime();
+    }
+
+    if (key == KB_8 && getSongTime() > loop_start) {
+      feedGame((ReplayEvent){.kind = RP_LOOP, .a = loop_start, .b = getSongTime()});
+      feedGame((ReplayEvent){.kind = RP_SEEK, .a = loop_start});
+    }
+
+    if (key == KB_9) {
+      feedGame((ReplayEvent){.kind = RP_LOOP});
+    }
+
+    if (key == KB_0) {
+      feedGame((ReplayEvent){.kind = RP_SEEK, .a = getSongTime() - TICKS(SEEK_TICKS)});
+    }
+
+    if (key == KB_POUND) {
+      feedGame((ReplayEvent){.kind = RP_SEEK, .a = getSongTime() + TICKS(SEEK_TICKS)});
+    }
+
+    if (key == KB_D) {
+      openMenu();
+      continue;
     }
 
     if (key == KB_STAR) {
@@ -88,31 +214,238 @@ void loop() {
     }
   }
 
-  // check for fret key release
+  if (isMenuOpen()) {
+    return;
+  }
+
+  // check for fret key release, a mask test per fret
   for (int i = 1; i <= 4; ++i) {
     if (LCDisFretPressed(i) && !isKeyHeld(KB_ROW_KEY(1) | KB_COL_KEY(i))) {
-      handleFretRelease(i);
+      feedGame((ReplayEvent){.kind = RP_RELEASE, .col = i});
     }
   }
-  int moves = atomic_exchange(&to_move, 0);
-  if (moves > 0) {
-    handleTicks(moves);
+}
+
+// Every loop is a frame: the input first, then the game logic, which only
+// marks what has to be redrawn, then as much of the drawing as fits in the
+// frame's budget. The rest waits for the next frames: moves of a column add
+// up and only the latest score is drawn, so when the frames are overloaded
+// the pictures in between are dropped instead of the input waiting for them.
+// The core runs at twice the rate TIM5 counts at.
+#define CYCLES_PER_TICK (2 * COUNTS_PER_TICK)
+#define FRAME_BUDGET (CYCLES_PER_TICK / 2)
+// how often the frame stats are sent in debug builds
+#define REPORT_PERIOD (100 * CYCLES_PER_TICK)
+
+struct FrameStats {
+  uint32_t frames;
+  uint32_t overruns; // frames which took longer than the budget
+  uint32_t cut_short; // frames whose drawing the budget stopped
+  uint32_t worst; // cycles of the longest frame
+  uint32_t since; // cycle count of the last report
+} frame_stats;
+
+static void countFrame(uint32_t frame_start, bool cut_short) {
+  uint32_t now = readCycles();
+  uint32_t cycles = now - frame_start;
+  frame_stats.frames++;
+  if (cycles > FRAME_BUDGET) {
+    frame_stats.overruns++;
+  }
+  if (cut_short) {
+    frame_stats.cut_short++;
+  }
+  if (cycles > frame_stats.worst) {
+    frame_stats.worst = cycles;
+  }
+
+#ifndef NDEBUG
+  if (now - frame_stats.since >= REPORT_PERIOD) {
+    char msg[] = "Frames ........ overruns ........ cut short ........ worst ........ cycles\n";
+    printUint(msg + sizeof("Frames ........") - 1, frame_stats.frames);
+    printUint(msg + sizeof("Frames ........ overruns ........") - 1, frame_stats.overruns);
+    printUint(msg + sizeof("Frames ........ overruns ........ cut short ........") - 1,
+              frame_stats.cut_short);
+    printUint(msg + sizeof("Frames ........ overruns ........ cut short ........ worst ........") - 1,
+              frame_stats.worst);
+    dmaSendWithCopy(msg, sizeof(msg) - 1);
+    frame_stats = (struct FrameStats){.since = now};
+
+    // the messages which didn't fit in the UART queue since the last report, if any
+    static uint32_t reported_drops = 0;
+    DmaUartStats uart = dmaGetStats();
+    if (uart.drops != reported_drops) {
+      char drops_msg[] = "UART dropped ........ messages, peak queue ........\n";
+      printUint(drops_msg + sizeof("UART dropped ........") - 1, uart.drops - reported_drops);
+      printUint(drops_msg + sizeof("UART dropped ........ messages, peak queue ........") - 1,
+                uart.peak_depth);
+      dmaSendWithCopy(drops_msg, sizeof(drops_msg) - 1);
+      reported_drops = uart.drops;
+    }
+  }
+#endif
+}
+
+static_assert(__builtin_popcount(CLOCK_STEP) == 1, "the clock is rounded down to a step with a mask");
+
+// the last clock the game was fed
+songtime_t fed_clock = -1;
+
+// Draws pending pieces until the frame's budget runs out, at least one so
+// that the screen always catches up in the end. Returns true if the budget
+// stopped it with drawing left for the next frames.
+static bool drawWithinBudget(uint32_t frame_start) {
+  if (!drawPending()) {
+    return false;
+  }
+  while (readCycles() - frame_start < FRAME_BUDGET) {
+    if (!drawPending()) {
+      return false;
+    }
+  }
+  return isDrawingPending();
+}
+
+void loop() {
+  uint32_t frame_start = readCycles();
+
+  handleInput();
+
+  // the game waits while a song is picked, the menu draws itself on key presses
+  bool cut_short = false;
+  if (!isMenuOpen()) {
+    // however long the last frame took, the notes are placed where they belong now
+    // (to the clock step, anything finer wouldn't move them)
+    songtime_t clock = gameTime() & ~(CLOCK_STEP - 1);
+    if (clock != fed_clock) {
+      fed_clock = clock;
+      feedGame((ReplayEvent){.kind = RP_TIME, .a = clock});
+    }
+
+    cut_short = drawWithinBudget(frame_start);
   }
+
+  // sends everything drawn above in retained mode, does nothing otherwise
+  LCDflush();
+
+  // the game's trace events and the recording of its input, in debug builds
+  traceFlush();
+  replayFlush();
+
+  countFrame(frame_start, cut_short);
+}
+
+#ifndef NDEBUG
+static void reportBlendCycles() {
+  LcdBlendCycles cycles = LCDbenchmarkBlend(readCycles);
+
+  char msg[] = "Cycles per note: divide ........ lookup ........ sprite ........\n";
+  printUint(msg + sizeof("Cycles per note: divide ........") - 1, cycles.divide);
+  printUint(msg + sizeof("Cycles per note: divide ........ lookup ........") - 1, cycles.lookup);
+  printUint(msg + sizeof("Cycles per note: divide ........ lookup ........ sprite ........") - 1,
+            cycles.sprite);
+  dmaSendWithCopy(msg, sizeof(msg) - 1);
+
+  char row_msg[] = "Cycles per row: lookup ........\n";
+  printUint(row_msg + sizeof("Cycles per row: lookup ........") - 1, cycles.row_lookup);
+  dmaSendWithCopy(row_msg, sizeof(row_msg) - 1);
+}
+
+static void reportBoardCost() {
+  LcdBoardCost cost = LCDbenchmarkBoard(readCycles);
+
+  char msg[] = "Board: ........ bytes of flash, decoded in ........ cycles\n";
+  printUint(msg + sizeof("Board: ........") - 1, cost.flash_bytes);
+  printUint(msg + sizeof("Board: ........ bytes of flash, decoded in ........") - 1,
+            cost.decode_cycles);
+  dmaSendWithCopy(msg, sizeof(msg) - 1);
 }
+#endif
+
+#ifdef REPLAY
+// written by communicator/trace_decoder --replay
+static const uint8_t replay_bytes[] = {
+#include "replay.txt"
+};
+
+// Plays replay.txt instead of the keyboard and the game clock, as fast as it
+// goes: every step of the clock is drawn completely and timed, the checks
+// recorded with it are compared. Debug builds send the results over UART.
+// The game is left where the replay ended, paused until * is pressed.
+static void playReplay() {
+  ReplayDecoder decoder;
+  startDecoding(&decoder, replay_bytes, sizeof(replay_bytes));
+  ReplayEvent event;
+  uint32_t steps = 0, worst = 0, checks = 0, failed = 0;
+  uint64_t total = 0;
+  while (decodeEvent(&decoder, &event)) {
+    if (event.kind == RP_CHECK) {
+      checks++;
+      if (getScore() != (uint64_t)event.a || getGameDigest() != (uint32_t)event.b) {
+        failed++;
+      }
+      continue;
+    }
+    uint32_t start = readCycles();
+    applyEvent(&event);
+    if (event.kind == RP_TIME) {
+      while (drawPending()) {
+      }
+      LCDflush();
+      uint32_t cycles = readCycles() - start;
+      steps++;
+      total += cycles;
+      worst = cycles > worst ? cycles : worst;
+    }
+    traceFlush();
+  }
+  fed_clock = decoder.clock;
+  game_counts = ((uint64_t)decoder.clock * COUNTS_PER_TICK) >> TIME_FRAC_BITS;
+  (void)failed;
+
+#ifndef NDEBUG
+  char msg[] = "Replay: ........ steps, average ........ worst ........ cycles\n";
+  printUint(msg + sizeof("Replay: ........") - 1, steps);
+  printUint(msg + sizeof("Replay: ........ steps, average ........") - 1,
+            steps ? (uint32_t)(total / steps) : 0);
+  printUint(msg + sizeof("Replay: ........ steps, average ........ worst ........") - 1, worst);
+  dmaSendWithCopy(msg, sizeof(msg) - 1);
+
+  char checks_msg[] = "Replay: ........ checks, ........ failed, score ........\n";
+  printUint(checks_msg + sizeof("Replay: ........") - 1, checks);
+  printUint(checks_msg + sizeof("Replay: ........ checks, ........") - 1, failed);
+  printUint(checks_msg + sizeof("Replay: ........ checks, ........ failed, score ........") - 1,
+            (uint32_t)getScore());
+  dmaSendWithCopy(checks_msg, sizeof(checks_msg) - 1);
+#endif
+}
+#endif
 
 int main() {
   initDmaUart();
   initKb();
   initLcd();
+  initCycleCounter();
   DMA_DBG("\n\nStarting Gietar Hiero!\n");
+#ifndef NDEBUG
+  reportBlendCycles();
+  reportBoardCost();
+#endif
 
   LCDdrawBoard();
-
-  updateScore();
+  LCDsetScrollMode(true);
 
   initGameTimer();
+  setKbClock(timerCount);
   initSpeakerTimer();
 
+  // loads the song and draws the score
+  feedGame((ReplayEvent){.kind = RP_RESET});
+
+#ifdef REPLAY
+  playReplay();
+#endif
+
   while (true) {
     loop();
   }
@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib/include/keyboard.h"
+#include "lib/include/lcd.h"
+#include "game.h"
+#include "menu.h"
+
+// text lines of the 8x16 font: the header, the songs, a gap and
+// the length and notes of the selected song
+#define TEXT_LINES (LCD_PIXEL_HEIGHT / 16)
+#define FIRST_SONG_LINE 1
+#define SONG_LINES (TEXT_LINES - 3)
+#define INFO_LINE (TEXT_LINES - 1)
+
+#define MAX_TEXT_WIDTH 32
+
+static struct {
+  bool open;
+  int selected;
+  int first_shown; // the list scrolls if there are more songs than lines
+} menu;
+
+// the text is cut or padded with spaces to the width of the screen, so
+// that every line overwrites the last one (only changed characters are sent)
+static void putLine(int line, const char* text) {
+  int width = LCDgetTextWidth();
+  if (width > MAX_TEXT_WIDTH) {
+    width = MAX_TEXT_WIDTH;
+  }
+  char buf[MAX_TEXT_WIDTH + 1];
+  int length = strlen(text);
+  if (length > width) {
+    length = width;
+  }
+  memcpy(buf, text, length);
+  memset(buf + length, ' ', width - length);
+  buf[width] = '\0';
+  LCDgoto(line, 0);
+  LCDputString(buf);
+}
+
+// writes n into buf, returns the end of it
+static char* printInt(char* buf, int n) {
+  char digits[12];
+  int count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (count > 0) {
+    *buf++ = digits[--count];
+  }
+  return buf;
+}
+
+static void drawMenu() {
+  if (menu.selected < menu.first_shown) {
+    menu.first_shown = menu.selected;
+  } else if (menu.selected >= menu.first_shown + SONG_LINES) {
+    menu.first_shown = menu.selected - SONG_LINES + 1;
+  }
+
+  putLine(0, "Select a song:");
+  for (int i = 0; i < SONG_LINES; ++i) {
+    int song = menu.first_shown + i;
+    char text[MAX_TEXT_WIDTH + 1] = "";
+    if (song < getSongCount()) {
+      text[0] = song == menu.selected ? '>' : ' ';
+      strncpy(text + 1, getSongInfo(song).title, MAX_TEXT_WIDTH - 1);
+    }
+    putLine(FIRST_SONG_LINE + i, text);
+  }
+
+  // e.g. "0:58, 193 notes"
+  SongInfo info = getSongInfo(menu.selected);
+  int seconds = (info.length + TICKS(99)) / TICKS(100);
+  char text[MAX_TEXT_WIDTH + 1];
+  char* end = printInt(text, seconds / 60);
+  *end++ = ':';
+  *end++ = '0' + seconds % 60 / 10;
+  *end++ = '0' + seconds % 10;
+  memcpy(end, ", ", 2);
+  end = printInt(end + 2, info.note_count);
+  strcpy(end, " notes");
+  putLine(INFO_LINE, text);
+}
+
+void openMenu() {
+  // the scrolled board would move the text with it
+  LCDsetScrollMode(false);
+  LCDclear();
+  menu.open = true;
+  menu.selected = getSelectedSong();
+  drawMenu();
+}
+
+bool isMenuOpen() {
+  return menu.open;
+}
+
+static int closeMenu(int song) {
+  menu.open = false;
+  LCDclear();
+  LCDdrawBoard();
+  LCDsetScrollMode(true);
+  return song;
+}
+
+int handleMenuKey(KbKey key) {
+  if (key == KB_B && menu.selected > 0) {
+    menu.selected--;
+    drawMenu();
+  } else if (key == KB_C && menu.selected + 1 < getSongCount()) {
+    menu.selected++;
+    drawMenu();
+  } else if (key == KB_D) {
+    return closeMenu(menu.selected);
+  } else if (key == KB_STAR) {
+    return closeMenu(getSelectedSong());
+  }
+  return MENU_OPEN;
+}
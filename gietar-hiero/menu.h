@@ -0,0 +1,21 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <stdbool.h>
+
+#include "lib/include/keyboard.h"
+
+// Song select, drawn over the whole screen instead of the board.
+// B and C move the selection, D plays the selected song, * goes back
+// to the song which was playing.
+
+// returned by handleMenuKey while the menu stays open
+#define MENU_OPEN (-1)
+
+void openMenu();
+bool isMenuOpen();
+// Returns the song to play once the menu is closed (the board is drawn
+// again by then, the song has to be selected), MENU_OPEN until then.
+int handleMenuKey(KbKey key);
+
+#endif  // MENU_H
@@ -0,0 +1,307 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lib/include/dma_uart.h"
+#include "lib/include/trace.h"
+#include "game.h"
+#include "replay.h"
+
+// a run of RP_TIME events, only in the encoding
+#define RP_RUN 15
+
+void applyEvent(const ReplayEvent* event) {
+  switch (event->kind) {
+    case RP_TIME:
+      handleTime(event->a);
+      break;
+    case RP_PRESS:
+      handleFretPress(event->col, event->a);
+      break;
+    case RP_RELEASE:
+      handleFretRelease(event->col);
+      break;
+    case RP_SPEED:
+      setScrollSpeed(event->a);
+      break;
+    case RP_LATENCY:
+      setLatencyOffset(event->a);
+      break;
+    case RP_SEEK:
+      seekTo(event->a);
+      break;
+    case RP_LOOP:
+      setLoop(event->a, event->b);
+      break;
+    case RP_SONG:
+      selectSong(event->a);
+      break;
+    case RP_RESET:
+      resetGame();
+      break;
+    case RP_CHECK:
+    default:
+      break;
+  }
+}
+
+// Encoding
+
+static int putVarint(uint8_t* out, uint64_t value) {
+  int length = 0;
+  while (value >= 0x80) {
+    out[length++] = value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+// small negative numbers stay short too
+static uint64_t zigzag(int64_t value) {
+  return (uint64_t)value << 1 ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+int finishEncoding(ReplayEncoder* encoder, uint8_t* out) {
+  if (encoder->run_length == 0) {
+    return 0;
+  }
+  int length = 0;
+  out[length++] = RP_RUN;
+  length += putVarint(out + length, encoder->run_steps);
+  length += putVarint(out + length, encoder->run_length);
+  encoder->run_length = 0;
+  return length;
+}
+
+static int encodeEvent(ReplayEncoder* encoder, const ReplayEvent* event, uint8_t* out) {
+  if (event->kind == RP_TIME) {
+    // while the loop keeps up, the clock goes a step at a time
+    songtime_t delta = event->a - encoder->clock;
+    if (delta > 0 && delta % CLOCK_STEP == 0 && delta / CLOCK_STEP < UINT16_MAX) {
+      uint32_t steps = delta / CLOCK_STEP;
+      encoder->clock = event->a;
+      if (encoder->run_length > 0 && steps == encoder->run_steps) {
+        encoder->run_length++;
+        return 0;
+      }
+      int length = finishEncoding(encoder, out);
+      encoder->run_steps = steps;
+      encoder->run_length = 1;
+      return length;
+    }
+  }
+
+  int length = finishEncoding(encoder, out);
+  out[length++] = event->kind | event->col << 4;
+  switch (event->kind) {
+    case RP_TIME:
+      length += putVarint(out + length, zigzag(event->a - encoder->clock));
+      encoder->clock = event->a;
+      break;
+    case RP_PRESS:
+      // stamped a bit before the clock
+      length += putVarint(out + length, zigzag(event->a - encoder->clock));
+      break;
+    case RP_SPEED:
+    case RP_LATENCY:
+    case RP_SEEK:
+    case RP_SONG:
+      length += putVarint(out + length, zigzag(event->a));
+      break;
+    case RP_LOOP:
+      length += putVarint(out + length, zigzag(event->a));
+      length += putVarint(out + length, zigzag(event->b));
+      break;
+    case RP_CHECK:
+      length += putVarint(out + length, event->a);
+      length += putVarint(out + length, event->b);
+      break;
+    case RP_RELEASE:
+    case RP_RESET:
+    default:
+      break;
+  }
+  return length;
+}
+
+int playAndEncode(ReplayEncoder* encoder, const ReplayEvent* event, uint8_t* out) {
+  applyEvent(event);
+  int length = encodeEvent(encoder, event, out);
+  if (event->kind == RP_TIME
+      && (event->a < encoder->checked || event->a - encoder->checked >= REPLAY_CHECK_PERIOD)) {
+    encoder->checked = event->a;
+    ReplayEvent check = {RP_CHECK, 0, getScore(), getGameDigest()};
+    length += encodeEvent(encoder, &check, out + length);
+  }
+  return length;
+}
+
+// Decoding
+
+void startDecoding(ReplayDecoder* decoder, const uint8_t* bytes, size_t size) {
+  *decoder = (ReplayDecoder){.next = bytes, .end = bytes + size};
+}
+
+static bool getVarint(ReplayDecoder* decoder, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; decoder->next < decoder->end && shift < 64; shift += 7) {
+    uint8_t byte = *decoder->next++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool getSigned(ReplayDecoder* decoder, songtime_t* value) {
+  uint64_t raw;
+  if (!getVarint(decoder, &raw)) {
+    return false;
+  }
+  *value = unzigzag(raw);
+  return true;
+}
+
+bool decodeEvent(ReplayDecoder* decoder, ReplayEvent* event) {
+  while (decoder->run_left == 0) {
+    if (decoder->next >= decoder->end) {
+      return false;
+    }
+    uint8_t head = *decoder->next++;
+    int kind = head & 0xf;
+    *event = (ReplayEvent){.kind = kind, .col = head >> 4};
+    uint64_t steps, count;
+    switch (kind) {
+      case RP_RUN:
+        if (!getVarint(decoder, &steps) || !getVarint(decoder, &count)) {
+          return false;
+        }
+        decoder->run_steps = steps;
+        decoder->run_left = count;
+        continue;
+      case RP_TIME:
+        if (!getSigned(decoder, &event->a)) {
+          return false;
+        }
+        decoder->clock += event->a;
+        event->a = decoder->clock;
+        return true;
+      case RP_PRESS:
+        if (!getSigned(decoder, &event->a)) {
+          return false;
+        }
+        event->a += decoder->clock;
+        return true;
+      case RP_SPEED:
+      case RP_LATENCY:
+      case RP_SEEK:
+      case RP_SONG:
+        return getSigned(decoder, &event->a);
+      case RP_LOOP:
+        return getSigned(decoder, &event->a) && getSigned(decoder, &event->b);
+      case RP_CHECK:
+        if (!getVarint(decoder, &steps) || !getVarint(decoder, &count)) {
+          return false;
+        }
+        event->a = steps;
+        event->b = count;
+        return true;
+      case RP_RELEASE:
+      case RP_RESET:
+        return true;
+      default:
+        return false; // not a replay
+    }
+  }
+  decoder->run_left--;
+  decoder->clock += decoder->run_steps * CLOCK_STEP;
+  *event = (ReplayEvent){.kind = RP_TIME, .a = decoder->clock};
+  return true;
+}
+
+// Recording
+
+#ifndef NDEBUG
+
+// at most a few bytes a second while playing, the UART sends about 900
+#define REPLAY_LOG_SIZE 2048
+static_assert(__builtin_popcount(REPLAY_LOG_SIZE) == 1, "replay log size must be a power of two");
+
+// frames are sent once they're this long, or after every check
+#define REPLAY_FRAME_MIN 64
+#define REPLAY_FRAME_MAX 255
+
+static struct {
+  uint8_t bytes[REPLAY_LOG_SIZE];
+  uint32_t head; // written by feedGame
+  uint32_t tail; // sent, moved by replayFlush
+  uint32_t sending; // bytes handed to the DMA, from tail on
+  bool stopped; // the ring was full, a replay with a gap in it is no use
+  uint16_t frames; // sent, numbers them so lost ones are noticed
+  songtime_t flushed_check; // the encoder's last check, when it was sent
+  ReplayEncoder encoder;
+  uint8_t frame[sizeof(uint64_t) + REPLAY_FRAME_MAX]; // a TR_REPLAY event, then the bytes
+} replay_log;
+
+void feedGame(ReplayEvent event) {
+  uint8_t encoded[REPLAY_MAX_ENCODED];
+  int length = playAndEncode(&replay_log.encoder, &event, encoded);
+  if (replay_log.stopped) {
+    return;
+  }
+  uint32_t head = replay_log.head;
+  if (REPLAY_LOG_SIZE - (head - replay_log.tail) < (uint32_t)length) {
+    replay_log.stopped = true;
+    DMA_DBG("Replay log full, recording stopped\n");
+    return;
+  }
+  for (int i = 0; i < length; ++i) {
+    replay_log.bytes[(head + i) & (REPLAY_LOG_SIZE - 1)] = encoded[i];
+  }
+  replay_log.head = head + length;
+}
+
+void replayFlush() {
+  // like traceFlush, one frame at a time, when nothing else is being sent
+  if (!dmaSendIdle()) {
+    return;
+  }
+  replay_log.tail += replay_log.sending;
+  replay_log.sending = 0;
+
+  uint32_t count = replay_log.head - replay_log.tail;
+  bool checked = replay_log.encoder.checked != replay_log.flushed_check;
+  if (count == 0 || (count < REPLAY_FRAME_MIN && !checked)) {
+    return;
+  }
+  if (count > REPLAY_FRAME_MAX) {
+    count = REPLAY_FRAME_MAX;
+  }
+  replay_log.flushed_check = replay_log.encoder.checked;
+
+  uint64_t header = TRACE_PACK(TR_REPLAY, count, replay_log.frames++, trace_ring.tick);
+  memcpy(replay_log.frame, &header, sizeof(header));
+  for (uint32_t i = 0; i < count; ++i) {
+    replay_log.frame[sizeof(header) + i] =
+      replay_log.bytes[(replay_log.tail + i) & (REPLAY_LOG_SIZE - 1)];
+  }
+  replay_log.sending = count;
+  dmaSend((const char*)replay_log.frame, sizeof(header) + count);
+}
+
+#else
+
+void feedGame(ReplayEvent event) {
+  applyEvent(&event);
+}
+
+void replayFlush() {
+}
+
+#endif
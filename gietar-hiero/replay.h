@@ -0,0 +1,89 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "game.h"
+
+// Everything main feeds the game goes through feedGame as an event, so a
+// session can be recorded and played again: the game only depends on its
+// input, a replay ends with the same score and the same notes on the board.
+//
+// Debug builds record the events into a ring buffer, encoded as deltas,
+// which replayFlush sends over the UART in frames of up to 255 bytes, each
+// after a TR_REPLAY trace event. communicator/trace_decoder --replay
+// collects them into a replay.txt, which game_sim --replay plays on the host,
+// and a firmware built with -DREPLAY plays on the board.
+//
+// Every second of clock a check records the score and getGameDigest, so a
+// replay which goes its own way is caught where it does.
+
+typedef enum {
+  RP_TIME, // handleTime(a)
+  RP_PRESS, // handleFretPress(col, a)
+  RP_RELEASE, // handleFretRelease(col)
+  RP_SPEED, // setScrollSpeed(a)
+  RP_LATENCY, // setLatencyOffset(a)
+  RP_SEEK, // seekTo(a)
+  RP_LOOP, // setLoop(a, b)
+  RP_SONG, // selectSong(a)
+  RP_RESET, // resetGame()
+  RP_CHECK, // not fed, recorded: getScore() is a, getGameDigest() b
+} ReplayKind;
+
+typedef struct {
+  ReplayKind kind;
+  int col;
+  songtime_t a, b;
+} ReplayEvent;
+
+// main feeds the clock in these steps, the time a note takes to move a pixel
+// at the highest speed, so the notes move as smoothly as they can and a run
+// of steps is recorded as one event
+#define CLOCK_STEP (TICKS(1) * DEFAULT_SPEED / MAX_SPEED)
+
+#define REPLAY_CHECK_PERIOD TICKS(100)
+
+// calls the game function the event stands for
+void applyEvent(const ReplayEvent* event);
+
+// The encoding, in records of a kind byte (the ReplayKind, or RP_RUN for
+// a run of clock steps, | col << 4) and its numbers, varints (signed ones
+// zigzag encoded). Clock times are deltas from the last RP_TIME.
+typedef struct {
+  songtime_t clock; // of the last RP_TIME
+  songtime_t checked; // clock of the last check
+  // RP_TIME events not written yet, each steps CLOCK_STEP after the last
+  uint32_t run_steps, run_length;
+} ReplayEncoder;
+
+// enough for two records, the run held back and the event
+#define REPLAY_MAX_ENCODED 48
+
+// Applies the event, like feedGame, then encodes it into out, returns the
+// number of bytes written. A check follows when it's time for one.
+int playAndEncode(ReplayEncoder* encoder, const ReplayEvent* event, uint8_t* out);
+// writes out the run held back, returns the number of bytes
+int finishEncoding(ReplayEncoder* encoder, uint8_t* out);
+
+typedef struct {
+  const uint8_t* next;
+  const uint8_t* end;
+  songtime_t clock;
+  uint32_t run_steps, run_left;
+} ReplayDecoder;
+
+void startDecoding(ReplayDecoder* decoder, const uint8_t* bytes, size_t size);
+// false at the end (or at a record cut short)
+bool decodeEvent(ReplayDecoder* decoder, ReplayEvent* event);
+
+// applies the event, recording it in debug builds
+void feedGame(ReplayEvent event);
+
+// Hands the next frame of the recording to the DMA when the UART is idle.
+// Call it every loop, it never waits.
+void replayFlush();
+
+#endif // REPLAY_H
@@ -2,7 +2,7 @@
 #include <stm32.h>
 #include <gpio.h>
 #include "speaker.h"
-#include "dma_uart.h"
+#include "trace.h"
 
 #define SPEAKER_GPIO GPIOB
 #define SPEAKER_PIN 7
@@ -65,14 +65,7 @@ static void updateFreq() {
 void changeWaveLen(int by) {
   fakeWaveLen += by;
   updateFreq();
-  char msg[] = "Freq changed to ______\n";
-  int first = sizeof("Freq changed to ") - 1;
-  int digit = 100000;
-  for (int i = 0; i < 6; ++i) {
-    msg[first + i] = '0' + (fakeWaveLen % (digit * 10)) / digit;
-    digit /= 10;
-  }
-  dmaSendWithCopy(msg, sizeof(msg) - 1);
+  trace(TR_WAVE_LEN, 0, fakeWaveLen);
 }
 
 // Lookup table for note wavelengths generated by manually finding a couple of notes 
@@ -92,10 +85,6 @@ int getNoteLength(Note note) {
 }
 
 void setNote(Note note) {
-  char msg[] = "Setting note with octave=_ and letter=__\n";
-  msg[sizeof("Setting note with octave=") - 1] = note.octave + '0';
-  msg[sizeof("Setting note with octave=_ and letter=") - 1] = (note.letter / 10) + '0';
-  msg[sizeof("Setting note with octave=_ and letter=")] = (note.letter % 10) + '0';
-  dmaSendWithCopy(msg, sizeof(msg) - 1);
+  trace(TR_NOTE, note.octave, note.letter);
   changeWaveLen(getNoteLength(note) - fakeWaveLen);
 }
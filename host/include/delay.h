@@ -0,0 +1,10 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+// Host stand-in for the course SDK header, only what lcd.c needs.
+
+#define MAIN_CLOCK_MHZ 16
+
+void Delay(unsigned count);
+
+#endif // DELAY_H
@@ -0,0 +1,23 @@
+#ifndef FONTS_H
+#define FONTS_H
+
+// Host stand-in for the course SDK header.
+// The real glyph tables live in the SDK and aren't part of this repository,
+// so host builds use a placeholder font with the same metrics (see font.c).
+
+#include <stdint.h>
+
+typedef struct {
+  const uint16_t* table;
+  uint16_t width;
+  uint16_t height;
+} font_t;
+
+#define FIRST_CHAR ' '
+#define LAST_CHAR '~'
+
+extern const font_t font8x16;
+
+#define LCD_DEFAULT_FONT font8x16
+
+#endif // FONTS_H
@@ -0,0 +1,35 @@
+#ifndef SPI_MOCK_H
+#define SPI_MOCK_H
+
+// Host replacement for the LCD wiring.
+//
+// Transports built with LCD_SPI_MOCK report every pin change and every SPI
+// frame here. Both are decoded into the bytes the controller would latch,
+// tagged with the level of A0 (command or data), and handed to the sink.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  LCD_PIN_CS,
+  LCD_PIN_A0,
+  LCD_PIN_SDA,
+  LCD_PIN_SCK,
+} LcdPin;
+
+// bit-banged transport
+void spiMockPin(LcdPin pin, uint32_t level);
+
+// SPI transport, bits is the frame size (8 or 16)
+void spiMockFrame(uint32_t frame, uint32_t bits);
+
+typedef void (*SpiMockSink)(bool is_data, uint8_t byte);
+
+void spiMockSetSink(SpiMockSink sink);
+
+// bytes clocked while CS was inactive, or CS released in the middle of a byte
+unsigned spiMockErrors(void);
+
+void spiMockReset(void);
+
+#endif // SPI_MOCK_H
@@ -0,0 +1,44 @@
+#ifndef ST7735S_H
+#define ST7735S_H
+
+// Software model of the ST7735S as wired on the board (128x160, RGB565 or
+// RGB444 transfers).
+//
+// Feed it the bytes the controller would latch (st7735sByte matches
+// SpiMockSink). It decodes the commands lcd.c sends, keeps the frame memory,
+// applies vertical scrolling when showing it, and counts traffic.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ST7735S_WIDTH 128
+#define ST7735S_HEIGHT 160
+
+typedef struct {
+  uint32_t bytes; // everything on the wire
+  uint32_t commands;
+  uint32_t windows; // CASET/RASET pairs
+  uint32_t pixels; // pixels written to memory
+} St7735sStats;
+
+void st7735sReset(void);
+void st7735sByte(bool is_data, uint8_t byte);
+
+// RGB565 pixel shown at (x, y) of the screen
+uint16_t st7735sPixel(int x, int y);
+
+St7735sStats st7735sStats(void);
+void st7735sClearStats(void);
+
+// commands the model doesn't know about, or parameters it didn't expect
+uint32_t st7735sErrors(void);
+
+// binary PPM (P6) of what is shown on the screen, returns false on I/O error
+bool st7735sWritePPM(const char* path);
+
+// Compares the screen with a PPM written by st7735sWritePPM. Pixels count
+// as differing when a channel (0-255) is off by more than tolerance.
+// Returns the number of differing pixels, or -1 if the file can't be read.
+int st7735sComparePPM(const char* path, int tolerance);
+
+#endif // ST7735S_H
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lcd_blend.h"
+
+// Checks the row blending kernel against the original formula for every
+// combination of board, image and alpha channel values, then times it.
+//
+// The channels are blended independently, so pixels are built from a single
+// 6-bit value v: green is v, red is v / 2 and blue is v % 32. Going through
+// all 64^3 triples of v covers every triple of every channel.
+
+#define VALUES 64
+#define ROW_SIZE (VALUES * VALUES)
+#define NOTE_WIDTH 32
+#define TIMED_ROWS 100000
+
+static uint16_t pixel(uint32_t v) {
+  return (v >> 1) << 11 | v << 5 | (v & 31);
+}
+
+static uint32_t expectedChannel(uint32_t bg, uint32_t img, uint32_t alpha, uint32_t max) {
+  return img * alpha / max + bg * (max - alpha) / max;
+}
+
+static uint16_t expected(uint16_t bg, uint16_t img, uint16_t alpha) {
+  uint32_t r = expectedChannel(bg >> 11, img >> 11, alpha >> 11, 31);
+  uint32_t g = expectedChannel(bg >> 5 & 63, img >> 5 & 63, alpha >> 5 & 63, 63);
+  uint32_t b = expectedChannel(bg & 31, img & 31, alpha & 31, 31);
+  return r << 11 | g << 5 | b;
+}
+
+typedef void (*BlendRow)(uint16_t* row, uint16_t img_pixel, const uint16_t* alpha, int count);
+
+static uint16_t board[ROW_SIZE];
+static uint16_t alphas[ROW_SIZE];
+static uint16_t row[ROW_SIZE];
+
+static int check(const char* name, BlendRow blend) {
+  int wrong = 0;
+  for (uint32_t img = 0; img < VALUES; ++img) {
+    memcpy(row, board, sizeof(row));
+    blend(row, pixel(img), alphas, ROW_SIZE);
+    for (int i = 0; i < ROW_SIZE; ++i) {
+      uint16_t want = expected(board[i], pixel(img), alphas[i]);
+      if (row[i] != want) {
+        if (wrong == 0) {
+          printf("%s: board %04x image %04x alpha %04x gives %04x instead of %04x\n",
+                 name, board[i], pixel(img), alphas[i], row[i], want);
+        }
+        wrong++;
+      }
+    }
+  }
+  return wrong;
+}
+
+static double nsPerRow(BlendRow blend) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < TIMED_ROWS; ++i) {
+    int offset = i % (ROW_SIZE / NOTE_WIDTH) * NOTE_WIDTH;
+    blend(row + offset, pixel(i % VALUES), alphas + offset, NOTE_WIDTH);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / TIMED_ROWS;
+}
+
+int main(void) {
+  LCDinitBlendTables();
+  for (int i = 0; i < ROW_SIZE; ++i) {
+    board[i] = pixel(i / VALUES);
+    alphas[i] = pixel(i % VALUES);
+  }
+
+  int wrong = check("lookup", LCDblendRow);
+  printf("%d of %d blended pixels wrong\n", wrong, VALUES * ROW_SIZE);
+
+  memcpy(row, board, sizeof(row));
+  printf("per %d pixel row: %.1f ns\n", NOTE_WIDTH, nsPerRow(LCDblendRow));
+  return wrong > 0;
+}
@@ -0,0 +1,27 @@
+#include "fonts.h"
+
+// Placeholder 8x16 font: every glyph is a box with its character code drawn
+// as a bar pattern inside, so text is still visible and deterministic in
+// host framebuffer dumps.
+
+#define GLYPHS (LAST_CHAR - FIRST_CHAR + 1)
+
+static uint16_t table[GLYPHS * 16];
+
+const font_t font8x16 = {
+  .table = table,
+  .width = 8,
+  .height = 16,
+};
+
+__attribute__((constructor))
+static void fillTable(void) {
+  for (int c = 1; c < GLYPHS; ++c) { // the space stays empty
+    uint16_t* glyph = &table[c * 16];
+    glyph[2] = glyph[13] = 0x7e;
+    for (int row = 3; row < 13; ++row) {
+      int bit = (row - 3) % 7;
+      glyph[row] = 0x42 | ((FIRST_CHAR + c) >> bit & 1 ? 0x18 : 0);
+    }
+  }
+}
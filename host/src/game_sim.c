@@ -0,0 +1,630 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+#include "keyboard.h"
+#include "lcd.h"
+#include "replay.h"
+#include "speaker.h"
+
+// Runs game.c without a board or a screen: the LCD and the speaker are
+// replaced by stand-ins which only count and record what the game asks of
+// them (game.c is built like the firmware, so the UART calls are gone).
+// A script of ticks and key presses drives the game, the score is read off
+// the screen like a player would.
+//
+//   game_sim [--trace] [--repeat <n>] [--step <ticks>] [--record <file>]
+//            [script | --replay <file>]
+//
+//   --trace     print every tick the game did something in: the score, the
+//               LCD calls made, the columns notes were spawned (+) and
+//               deleted (-) in and the frets pressed
+//   --repeat    play the script n times, for more precise timing
+//   --step      ticks of song time per handleTime call, 1 by default
+//   --record    write what the script fed the game into a replay file
+//               (replay.txt, like the firmware records, see replay.h)
+//   --replay    feed the game a replay file instead of a script: recorded
+//               on the board (through communicator/trace_decoder --replay)
+//               or with --record. The checks recorded with it have to match,
+//               otherwise the exit status is 1
+//
+// The script (one command per line, # starts a comment) is read from the file
+// given, otherwise the whole song is played perfectly:
+//   wait <ticks>       let the game run
+//   play               press every note as it reaches the fret and hold it to the end
+//                      of its tail, to the end of the song
+//   press <column>
+//   release <column>
+//   speed <speed>      setScrollSpeed, DEFAULT_SPEED is 256
+//   latency <ticks>    setLatencyOffset
+//   seek <ticks>       seekTo, the song time to jump to
+//   loop <start> <end> setLoop, in ticks of song time, loop 0 0 stops looping
+//                      (play never ends in a loop, wait instead)
+//   song <n>           selectSong, from 0, the first one is played by default
+//   reset              resetGame
+//
+// Everything but the timing at the end is deterministic, so two runs (e.g.
+// before and after a chart change) can be compared with diff.
+
+#define MAX_COMMANDS 4096
+
+// the LCD as the game sees it
+
+typedef enum {
+  L_GOTO,
+  L_PUT_STRING,
+  L_SCROLL_BOARD,
+  L_DRAW_COLUMN,
+  L_REMOVE_NOTE,
+  L_REPLACE_NOTE,
+  L_PRESS_FRET,
+  L_RELEASE_FRET,
+  LCD_CALLS,
+} LcdCall;
+
+static const char* const lcd_call_names[LCD_CALLS] = {
+  "LCDgoto", "LCDputString", "LCDscrollBoard", "LCDdrawColumn",
+  "LCDremoveNote", "LCDreplaceNote", "LCDpressFret", "LCDreleaseFret",
+};
+
+// Notes are spawned and deleted by the game, the screen only sees them
+// drawn and removed: a column drawn with more notes than it had after the
+// removals got new ones. Not while the notes are redrawn or cleared though,
+// then the counts only follow along.
+static struct {
+  unsigned long calls[LCD_CALLS];
+  uint64_t score;
+  // where the notes of every column were last drawn, for the autoplay
+  LcdNote notes[N_COLS + 1][LCD_COLUMN_NOTES];
+  int count[N_COLS + 1];
+  // a note reached the fret in the last step, this many pixels ago
+  int crossed[N_COLS + 1];
+  bool counting; // notes spawned and deleted
+  unsigned long spawned, deleted;
+} lcd = {.counting = true};
+
+static char events[256]; // of the current tick, for the trace
+static size_t events_length;
+
+static void addEvent(const char* format, int arg) {
+  if (events_length < sizeof(events)) {
+    events_length += snprintf(events + events_length, sizeof(events) - events_length,
+                              format, arg);
+  }
+}
+
+int LCDgetTextWidth() {
+  return LCD_PIXEL_WIDTH / 8;
+}
+
+void LCDgoto(int textLine, int charPos) {
+  (void)textLine;
+  (void)charPos;
+  lcd.calls[L_GOTO]++;
+}
+
+void LCDputString(const char* text) {
+  lcd.calls[L_PUT_STRING]++;
+  const char* score = strstr(text, "Score:");
+  if (score) {
+    lcd.score = strtoull(score + sizeof("Score:") - 1, NULL, 10);
+  }
+}
+
+void LCDscrollBoard(int deltay) {
+  (void)deltay;
+  lcd.calls[L_SCROLL_BOARD]++;
+}
+
+void LCDdrawColumn(int col, const LcdNote* notes, int count, int deltay) {
+  lcd.calls[L_DRAW_COLUMN]++;
+  // lcd.c would forget the rest
+  if (count > LCD_COLUMN_NOTES) {
+    fprintf(stderr, "%d notes in column %d, the LCD remembers %d\n", count, col, LCD_COLUMN_NOTES);
+    exit(1);
+  }
+  if (lcd.counting) {
+    for (int i = lcd.count[col]; i < count; ++i) {
+      lcd.spawned++;
+      addEvent(" +%d", col);
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    int y = notes[i].y;
+    lcd.notes[col][i] = notes[i];
+    if (notes[i].head && deltay > 0 && y >= FRET_PRESS_Y && y - deltay < FRET_PRESS_Y) {
+      lcd.crossed[col] = y - FRET_PRESS_Y + 1;
+    }
+  }
+  lcd.count[col] = count;
+}
+
+void LCDremoveNote(int col, int y) {
+  lcd.calls[L_REMOVE_NOTE]++;
+  for (int i = 0; i < lcd.count[col]; ++i) {
+    if (lcd.notes[col][i].y == y) {
+      memmove(&lcd.notes[col][i], &lcd.notes[col][i + 1],
+              (lcd.count[col] - i - 1) * sizeof(LcdNote));
+      lcd.count[col]--;
+      if (lcd.counting) {
+        lcd.deleted++;
+        addEvent(" -%d", col);
+      }
+      break;
+    }
+  }
+}
+
+void LCDreplaceNote(int col, int y, LcdNote note) {
+  lcd.calls[L_REPLACE_NOTE]++;
+  for (int i = 0; i < lcd.count[col]; ++i) {
+    if (lcd.notes[col][i].y == y) {
+      lcd.notes[col][i] = note;
+      break;
+    }
+  }
+}
+
+// a hit hold note's tail ends on the fret while it is held
+static bool isHolding(int col) {
+  for (int i = 0; i < lcd.count[col]; ++i) {
+    LcdNote note = lcd.notes[col][i];
+    if (!note.head && note.tail > 0 && note.y == FRET_PRESS_Y) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void LCDpressFret(int col) {
+  (void)col;
+  lcd.calls[L_PRESS_FRET]++;
+}
+
+void LCDreleaseFret(int col) {
+  (void)col;
+  lcd.calls[L_RELEASE_FRET]++;
+}
+
+static unsigned long lcdCallCount(void) {
+  unsigned long total = 0;
+  for (int i = 0; i < LCD_CALLS; ++i) {
+    total += lcd.calls[i];
+  }
+  return total;
+}
+
+// the speaker, only hits turn it on
+
+static unsigned long hits;
+
+void setNote(Note note) {
+  (void)note;
+}
+
+void speakerOn() {
+  hits++;
+}
+
+void speakerOff() {
+}
+
+// the script
+
+typedef enum {
+  C_WAIT,
+  C_PLAY,
+  C_PRESS,
+  C_RELEASE,
+  C_SPEED,
+  C_LATENCY,
+  C_SEEK,
+  C_LOOP,
+  C_SONG,
+  C_RESET,
+} CommandType;
+
+typedef struct {
+  CommandType type;
+  int arg, arg2;
+} Command;
+
+static const struct {
+  const char* name;
+  CommandType type;
+  int args;
+} command_names[] = {
+  {"wait", C_WAIT, 1},
+  {"play", C_PLAY, 0},
+  {"press", C_PRESS, 1},
+  {"release", C_RELEASE, 1},
+  {"speed", C_SPEED, 1},
+  {"latency", C_LATENCY, 1},
+  {"seek", C_SEEK, 1},
+  {"loop", C_LOOP, 2},
+  {"song", C_SONG, 1},
+  {"reset", C_RESET, 0},
+};
+
+static Command script[MAX_COMMANDS];
+static int script_length;
+
+static bool readScript(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[128];
+  for (int number = 1; fgets(line, sizeof(line), f); ++number) {
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    char name[16];
+    int arg = 0, arg2 = 0;
+    int fields = sscanf(line, "%15s %d %d", name, &arg, &arg2);
+    if (fields <= 0) {
+      continue;
+    }
+    size_t i = 0;
+    for (; i < sizeof(command_names) / sizeof(command_names[0]); ++i) {
+      if (strcmp(name, command_names[i].name) == 0) {
+        break;
+      }
+    }
+    if (i == sizeof(command_names) / sizeof(command_names[0])
+        || fields - 1 != command_names[i].args || script_length == MAX_COMMANDS) {
+      fprintf(stderr, "%s:%d: bad command\n", path, number);
+      fclose(f);
+      return false;
+    }
+    script[script_length++] = (Command){command_names[i].type, arg, arg2};
+  }
+  fclose(f);
+  return true;
+}
+
+// the game
+
+static struct {
+  bool trace;
+  int step;
+} options = {.step = 1};
+
+static long long tick;
+static songtime_t game_time;
+static bool autoplay_pressed[N_COLS + 1];
+static unsigned long ticks_run;
+static unsigned long max_lcd_calls; // in one tick
+static double tick_ns, max_tick_ns;
+
+static double nanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// the replay being written by --record, the first run only
+static struct {
+  const char* path;
+  ReplayEncoder encoder;
+  uint8_t* bytes;
+  size_t length, capacity;
+} recording;
+
+// everything the game gets goes through here, like feedGame on the board
+static void feed(ReplayEvent event) {
+  if (!recording.path) {
+    applyEvent(&event);
+    return;
+  }
+  if (recording.length + REPLAY_MAX_ENCODED > recording.capacity) {
+    recording.capacity = 2 * recording.capacity + REPLAY_MAX_ENCODED;
+    recording.bytes = realloc(recording.bytes, recording.capacity);
+    if (!recording.bytes) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  recording.length += playAndEncode(&recording.encoder, &event, recording.bytes + recording.length);
+}
+
+// at is the song time of the press
+static void press(int col, songtime_t at) {
+  addEvent(" press %d", col);
+  feed((ReplayEvent){.kind = RP_PRESS, .col = col, .a = at});
+}
+
+// handleTime, timed, then everything it left to draw
+static void feedTime(songtime_t clock) {
+  double start = nanoseconds();
+  feed((ReplayEvent){.kind = RP_TIME, .a = clock});
+  double took = nanoseconds() - start;
+  tick_ns += took;
+  max_tick_ns = took > max_tick_ns ? took : max_tick_ns;
+  ticks_run++;
+  // no frame budget here, everything is drawn every tick
+  while (drawPending()) {
+  }
+}
+
+static void endTick(unsigned long calls_before) {
+  unsigned long calls = lcdCallCount() - calls_before;
+  max_lcd_calls = calls > max_lcd_calls ? calls : max_lcd_calls;
+  if (options.trace && (events_length > 0 || calls > 0)) {
+    printf("%6lld score %6llu lcd %3lu%s\n", tick, (unsigned long long)lcd.score, calls, events);
+  }
+  events_length = 0;
+  events[0] = '\0';
+}
+
+static void runTick(bool autoplay) {
+  unsigned long calls_before = lcdCallCount();
+  for (int col = 1; col <= N_COLS; ++col) {
+    if (autoplay_pressed[col] && !isHolding(col)) {
+      feed((ReplayEvent){.kind = RP_RELEASE, .col = col});
+      autoplay_pressed[col] = false;
+    }
+  }
+
+  tick += options.step;
+  game_time += TICKS(options.step);
+  feedTime(game_time);
+
+  if (autoplay) {
+    for (int col = 1; col <= N_COLS; ++col) {
+      // stamped when the note reached the fret, like the keyboard would,
+      // however big the step was
+      if (lcd.crossed[col]) {
+        int pixels = lcd.crossed[col] - 1;
+        press(col, game_time - TICKS(pixels) * DEFAULT_SPEED / getScrollSpeed());
+        autoplay_pressed[col] = true;
+      }
+    }
+  }
+  for (int col = 1; col <= N_COLS; ++col) {
+    lcd.crossed[col] = 0;
+  }
+
+  // and the score of the presses
+  while (drawPending()) {
+  }
+  endTick(calls_before);
+}
+
+static void runCommand(const Command* command) {
+  switch (command->type) {
+    case C_WAIT:
+      for (long long end = tick + command->arg; tick < end; ) {
+        runTick(false);
+      }
+      break;
+    case C_PLAY:
+      while (!isSongOver()) {
+        runTick(true);
+      }
+      break;
+    case C_PRESS:
+      press(command->arg, game_time);
+      break;
+    case C_RELEASE:
+      feed((ReplayEvent){.kind = RP_RELEASE, .col = command->arg});
+      break;
+    case C_SPEED:
+      lcd.counting = false;
+      feed((ReplayEvent){.kind = RP_SPEED, .a = command->arg});
+      lcd.counting = true;
+      break;
+    case C_LATENCY:
+      feed((ReplayEvent){.kind = RP_LATENCY, .a = TICKS(command->arg)});
+      break;
+    case C_SEEK:
+      lcd.counting = false;
+      feed((ReplayEvent){.kind = RP_SEEK, .a = TICKS(command->arg)});
+      lcd.counting = true;
+      break;
+    case C_LOOP:
+      feed((ReplayEvent){.kind = RP_LOOP, .a = TICKS(command->arg), .b = TICKS(command->arg2)});
+      break;
+    case C_SONG:
+      game_time = 0;
+      lcd.counting = false;
+      feed((ReplayEvent){.kind = RP_SONG, .a = command->arg});
+      lcd.counting = true;
+      break;
+    case C_RESET:
+      game_time = 0;
+      lcd.counting = false;
+      feed((ReplayEvent){.kind = RP_RESET});
+      lcd.counting = true;
+      break;
+    default:
+      break;
+  }
+}
+
+// replay files are the contents of a byte array, like songs.txt
+static bool writeReplay(const char* path, const uint8_t* bytes, size_t length) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "// replay, %zu bytes\n", length);
+  for (size_t i = 0; i < length; ++i) {
+    fprintf(f, "0x%02x,%s", bytes[i], i % 16 == 15 || i + 1 == length ? "\n" : " ");
+  }
+  fclose(f);
+  return true;
+}
+
+static uint8_t* readReplay(const char* path, size_t* length) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  size_t capacity = 4096;
+  uint8_t* bytes = malloc(capacity);
+  *length = 0;
+  char line[256];
+  while (bytes && fgets(line, sizeof(line), f)) {
+    char* comment = strstr(line, "//");
+    if (comment) {
+      *comment = '\0';
+    }
+    for (char* next = line; (next = strstr(next, "0x")); ) {
+      if (*length == capacity) {
+        capacity *= 2;
+        bytes = realloc(bytes, capacity);
+        if (!bytes) {
+          break;
+        }
+      }
+      bytes[(*length)++] = strtoul(next, &next, 16);
+    }
+  }
+  fclose(f);
+  if (!bytes) {
+    perror("realloc");
+  }
+  return bytes;
+}
+
+static struct {
+  unsigned long checks, failed;
+  songtime_t first_failed; // clock of the first check which failed
+} replay_stats;
+
+// the replay as the board would play it with -DREPLAY, a tick for every step of the clock
+static void runReplay(const uint8_t* bytes, size_t length) {
+  ReplayDecoder decoder;
+  startDecoding(&decoder, bytes, length);
+  ReplayEvent event;
+  unsigned long calls_before = lcdCallCount();
+  while (decodeEvent(&decoder, &event)) {
+    if (event.kind == RP_CHECK) {
+      replay_stats.checks++;
+      if (getScore() != (uint64_t)event.a || getGameDigest() != (uint32_t)event.b) {
+        if (replay_stats.failed++ == 0) {
+          replay_stats.first_failed = decoder.clock;
+        }
+      }
+    } else if (event.kind == RP_TIME) {
+      feedTime(event.a);
+      tick = event.a >> TIME_FRAC_BITS;
+      endTick(calls_before);
+      calls_before = lcdCallCount();
+    } else {
+      // the counts would only follow along
+      lcd.counting = event.kind != RP_SEEK && event.kind != RP_SPEED
+        && event.kind != RP_SONG && event.kind != RP_RESET;
+      if (event.kind == RP_PRESS) {
+        addEvent(" press %d", event.col);
+      }
+      applyEvent(&event);
+      lcd.counting = true;
+    }
+  }
+  if (decoder.next != decoder.end) {
+    fprintf(stderr, "replay cut short, %zu bytes left\n", (size_t)(decoder.end - decoder.next));
+    replay_stats.failed++;
+  }
+}
+
+int main(int argc, char** argv) {
+  int repeat = 1;
+  const char* path = NULL;
+  const char* replay_path = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--trace") == 0) {
+      options.trace = true;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recording.path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+      options.step = atoi(argv[++i]);
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [--trace] [--repeat <n>] [--step <ticks>] [--record <file>]\n"
+                      "       [script | --replay <file>]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (repeat < 1 || options.step < 1) {
+    fprintf(stderr, "--repeat and --step take a positive number\n");
+    return 2;
+  }
+  uint8_t* replay = NULL;
+  size_t replay_length = 0;
+  if (replay_path) {
+    replay = readReplay(replay_path, &replay_length);
+    if (!replay) {
+      return 1;
+    }
+  } else if (path) {
+    if (!readScript(path)) {
+      return 1;
+    }
+  } else {
+    script[script_length++] = (Command){C_PLAY, 0, 0};
+  }
+
+  for (int run = 0; run < repeat; ++run) {
+    // every run starts from a fresh game, the trace only shows the first one
+    tick = 0;
+    game_time = 0;
+    lcd.counting = false;
+    feed((ReplayEvent){.kind = RP_RESET});
+    lcd.counting = true;
+    if (replay) {
+      runReplay(replay, replay_length);
+    } else {
+      for (int i = 0; i < script_length; ++i) {
+        runCommand(&script[i]);
+      }
+    }
+    if (recording.path) {
+      recording.length += finishEncoding(&recording.encoder, recording.bytes + recording.length);
+      if (!writeReplay(recording.path, recording.bytes, recording.length)) {
+        return 1;
+      }
+      printf("recorded %zu bytes\n", recording.length);
+      recording.path = NULL;
+    }
+    if (run == 0) {
+      printf("ticks %lld, score %llu\n", tick, (unsigned long long)lcd.score);
+      printf("notes spawned %lu, hit %lu, missed %lu\n",
+             lcd.spawned, hits, lcd.deleted - hits);
+      printf("LCD calls %lu, at most %lu in a tick\n", lcdCallCount(), max_lcd_calls);
+      for (int i = 0; i < LCD_CALLS; ++i) {
+        printf("  %-15s %8lu\n", lcd_call_names[i], lcd.calls[i]);
+      }
+      if (replay) {
+        printf("replay checks %lu, failed %lu", replay_stats.checks, replay_stats.failed);
+        if (replay_stats.failed > 0) {
+          printf(", the first at tick %lld", (long long)(replay_stats.first_failed >> TIME_FRAC_BITS));
+        }
+        printf("\n");
+      }
+      options.trace = false;
+    }
+  }
+
+  // a tick of song time is 10 ms, replays go a clock step at a time
+  double mean_ns = tick_ns / ticks_run;
+  double step_ns = replay ? 1e7 * CLOCK_STEP / TICKS(1) : 1e7 * options.step;
+  printf("handleTime: %.0f ns on average, %.0f ns at most, %.0fx real time\n",
+         mean_ns, max_tick_ns, step_ns / mean_ns);
+  free(replay);
+  return replay_stats.failed > 0;
+}
@@ -0,0 +1,359 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lcd.h"
+#include "lcd_transport.h"
+#include "spi_mock.h"
+#include "st7735s.h"
+
+// Draws a short game scene through lcd.c into the ST7735S model.
+// After every step the screen is checked against a golden image and the
+// traffic the step caused is printed, so that rendering changes can be judged
+// by the bytes they put on the wire.
+//
+//   lcd_emulator                 check against the golden images
+//   lcd_emulator --update        overwrite the golden images
+//   lcd_emulator --dump <dir>    write the images to <dir> instead
+//
+// The scene is drawn four times: as is, in retained mode (LCDflush after
+// every step), which has to produce the same images, and with RGB444
+// transfers, which have to match them up to the lost color bits, through
+// the bit-banged and the SPI/DMA transport (whose mock DMA reads a buffer
+// only when the next transfer waits for it).
+
+#ifndef GOLDEN_DIR
+#define GOLDEN_DIR "golden"
+#endif
+
+#define SCROLL_TICKS 10
+
+static void configure(void) {
+  LCDconfigure();
+  LCDsetFont(&font8x16);
+  LCDclear();
+}
+
+static void drawBoard(void) {
+  LCDdrawBoard();
+}
+
+static void putText(void) {
+  LCDgoto(0, 0);
+  for (const char* c = "Score: 1234"; *c; ++c) {
+    LCDputchar(*c);
+  }
+}
+
+static void pressFrets(void) {
+  LCDpressFret(1);
+  LCDpressFret(3);
+}
+
+static void drawNotes(void) {
+  LCDdrawNote(2, 40);
+  LCDdrawNote(4, 100);
+  LCDdrawNote(1, 125);
+}
+
+static void moveNotes(void) {
+  for (int i = 0; i < 5; ++i) {
+    LCDmoveNoteVertical(2, 40 + 3 * i, 3);
+    LCDmoveNoteVertical(4, 100 + 3 * i, 3);
+    LCDmoveNoteVertical(1, 125 + 3 * i, 3);
+  }
+}
+
+static void releaseFret(void) {
+  LCDreleaseFret(1);
+}
+
+static void removeNotes(void) {
+  LCDremoveNote(2, 55);
+  LCDremoveNote(4, 115);
+  LCDremoveNote(1, 140);
+}
+
+static void scrollNotes(void) {
+  LCDsetScrollMode(true);
+  LCDdrawNote(3, 20);
+  for (int i = 0; i < SCROLL_TICKS; ++i) {
+    LCDscrollBoard(2);
+    LCDmoveNoteVertical(3, 20 + 2 * i, 2);
+  }
+}
+
+// only the two changed digits should be sent, in one window
+static void updateScore(void) {
+  LCDgoto(0, 0);
+  LCDputString("Score: 1299");
+}
+
+// three notes two rows apart, each tick is one pass over the column
+static void moveColumn(void) {
+  LcdNote notes[3] = {{20, 0, true}, {42, 0, true}, {64, 0, true}};
+  LCDdrawColumn(2, notes, 3, 0);
+  for (int i = 0; i < 5; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      notes[j].y += 3;
+    }
+    LCDdrawColumn(2, notes, 3, 3);
+  }
+}
+
+// a sheet of two 12x12 frames: an opaque box and a half transparent pane
+#define SHEET_WIDTH 24
+#define FRAME_SIZE 12
+
+static uint16_t sheet[FRAME_SIZE * SHEET_WIDTH];
+static uint16_t sheet_alpha[FRAME_SIZE * SHEET_WIDTH];
+
+static const LcdImage box_image = {
+  .pixels = sheet, .stride = SHEET_WIDTH, .width = FRAME_SIZE, .height = FRAME_SIZE,
+};
+static const LcdImage pane_image = {
+  .pixels = sheet, .alpha = sheet_alpha, .stride = SHEET_WIDTH,
+  .x = FRAME_SIZE, .width = FRAME_SIZE, .height = FRAME_SIZE,
+};
+
+// shown sprites have to stay alive
+static LcdSprite box, glow, pane;
+
+// sprites over each other, the notes and every edge of the screen,
+// moved, scrolled and hidden
+static void drawSprites(void) {
+  for (int y = 0; y < FRAME_SIZE; ++y) {
+    for (int x = 0; x < SHEET_WIDTH; ++x) {
+      bool border = x % FRAME_SIZE == 0 || y == 0 || x % FRAME_SIZE == FRAME_SIZE - 1
+        || y == FRAME_SIZE - 1;
+      sheet[y * SHEET_WIDTH + x] = x < FRAME_SIZE ? (border ? 0x0000 : 0xf81f) : 0x07ff;
+      sheet_alpha[y * SHEET_WIDTH + x] = border ? 0xffff : 0x7bef;
+    }
+  }
+  box = (LcdSprite){.image = &box_image, .x = 10, .y = 75, .z = 2};
+  glow = (LcdSprite){.image = &lcd_note_image, .x = -12, .y = 70, .z = 1, .color = 0xffe0};
+  pane = (LcdSprite){.image = &pane_image, .x = 120, .y = 140, .z = 3};
+  LCDshowSprite(&box);
+  LCDshowSprite(&glow); // under the box, although shown later
+  LCDshowSprite(&pane);
+  LCDmoveSprite(&box, 40, 72);
+  LCDscrollBoard(2);
+  LcdNote notes[3] = {{37, 0, true}, {59, 0, true}, {81, 0, true}};
+  LCDdrawColumn(2, notes, 3, 2);
+  LCDhideSprite(&glow);
+  LCDdrawNoteXY(110, 150, N_GREEN);
+}
+
+#define HOLD_TICKS 4
+#define DEFERRED_SCROLLS 3
+
+// a hold note under a plain one, scrolled: the tail costs only the rows its
+// ends move over; then its head is hit and the tail is held on the fret
+// left where drawHolds moved them for deferHolds
+static LcdNote hold_notes[2];
+
+static void drawHolds(void) {
+  // the scene is drawn more than once
+  hold_notes[0] = (LcdNote){116, 60, true};
+  hold_notes[1] = (LcdNote){20, 0, true};
+  LCDdrawColumn(4, hold_notes, 2, 0);
+  for (int i = 0; i < HOLD_TICKS; ++i) {
+    LCDscrollBoard(3);
+    hold_notes[0].y += 3;
+    hold_notes[1].y += 3;
+    LCDdrawColumn(4, hold_notes, 2, 3);
+  }
+
+  LCDpressFret(4);
+  // the tail ends on the fret from now on
+  int top = hold_notes[0].y - hold_notes[0].tail;
+  LcdNote held = {FRET_PRESS_Y, FRET_PRESS_Y - top, false};
+  LCDreplaceNote(4, hold_notes[0].y, held);
+  hold_notes[0] = held;
+  for (int i = 0; i < HOLD_TICKS; ++i) {
+    LCDscrollBoard(3);
+    hold_notes[0].tail -= 3;
+    hold_notes[1].y += 3;
+    LCDdrawColumn(4, hold_notes, 2, 3);
+  }
+  LCDreleaseFret(4);
+}
+
+// the game draws a column less often than it scrolls when the frame's budget
+// runs out: the tail has to be whole again after the scrolls are added up
+static void deferHolds(void) {
+  LcdNote hold = {60, 200, true};
+  LCDdrawColumn(3, &hold, 1, 0);
+  for (int i = 0; i < DEFERRED_SCROLLS; ++i) {
+    LCDscrollBoard(2);
+  }
+  hold.y += 2 * DEFERRED_SCROLLS;
+  LCDdrawColumn(3, &hold, 1, 2 * DEFERRED_SCROLLS);
+  hold_notes[0].tail -= 2 * DEFERRED_SCROLLS;
+  hold_notes[1].y += 2 * DEFERRED_SCROLLS;
+  LCDdrawColumn(4, hold_notes, 2, 2 * DEFERRED_SCROLLS);
+}
+
+// RGB444 packs spans into two buffers in turns, a span which ends right
+// where a buffer fills up leaves the next pixels pending without sending
+static void packBoundary(void) {
+  static uint16_t stripes[LCD_PIXEL_WIDTH];
+  for (int i = 0; i < LCD_PIXEL_WIDTH; ++i) {
+    stripes[i] = i & 4 ? 0xffff : 0x001f; // white and blue
+  }
+  LCDbeginWindow(0, 136, LCD_PIXEL_WIDTH - 1, 139);
+  // a buffer is LCD_PIXEL_WIDTH pixels, 2 are left pending
+  LCDfillSpan(0xf800, LCD_PIXEL_WIDTH + 2); // red
+  LCDwriteSpan16(stripes, LCD_PIXEL_WIDTH);
+  LCDwriteSpan16(stripes, LCD_PIXEL_WIDTH);
+  LCDfillSpan(0x07e0, LCD_PIXEL_WIDTH - 2); // green
+  LCDendWindow();
+}
+
+typedef struct {
+  const char* name;
+  void (*draw)(void);
+  int calls; // of the measured operation, for the per call column
+} Step;
+
+static const Step steps[] = {
+  {"configure", configure, 1},
+  {"board", drawBoard, 1},
+  {"text", putText, 11},
+  {"press_fret", pressFrets, 2},
+  {"draw_note", drawNotes, 3},
+  {"move_note", moveNotes, 15},
+  {"release_fret", releaseFret, 1},
+  {"remove_note", removeNotes, 3},
+  {"scroll", scrollNotes, SCROLL_TICKS},
+  {"score", updateScore, 1},
+  {"column", moveColumn, 6},
+  {"sprites", drawSprites, 8},
+  {"holds", drawHolds, 2 * HOLD_TICKS + 1},
+  {"deferred_holds", deferHolds, 3},
+  {"pack_boundary", packBoundary, 4},
+};
+
+#define STEP_COUNT (sizeof(steps) / sizeof(steps[0]))
+
+static uint32_t nanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+typedef enum {
+  CHECK,
+  UPDATE,
+  DUMP,
+} Mode;
+
+typedef struct {
+  const char* name;
+  const LcdTransport* transport;
+  bool retained;
+  LcdPixelFormat format;
+  int tolerance; // see st7735sComparePPM
+} Run;
+
+static const Run runs[] = {
+  {"immediate mode, RGB565", &lcd_bitbang_transport, false, LCD_RGB565, 0},
+  {"retained mode, RGB565", &lcd_bitbang_transport, true, LCD_RGB565, 0},
+  // 4 bits per channel are off by at most 1/15 of the range
+  {"immediate mode, RGB444", &lcd_bitbang_transport, false, LCD_RGB444, 17},
+  {"immediate mode, RGB444, SPI/DMA", &lcd_spi_transport, false, LCD_RGB444, 17},
+};
+
+#define RUN_COUNT (sizeof(runs) / sizeof(runs[0]))
+
+// runs every step, then checks or writes its image, returns the failures
+static int runScene(const Run* run, Mode mode, const char* dir) {
+  st7735sReset();
+  spiMockReset();
+  LCDsetTransport(run->transport);
+  printf("%s\n", run->name);
+  printf("%-13s %8s %6s %6s %7s %9s  %s\n",
+         "step", "bytes", "cmds", "wins", "pixels", "bytes/op", "image");
+  int failed = 0;
+  for (size_t i = 0; i < STEP_COUNT; ++i) {
+    const Step* step = &steps[i];
+    st7735sClearStats();
+    step->draw();
+    if (i == 0 && run->format != LCD_RGB565) {
+      // LCDconfigure in the first step selects RGB565
+      LCDsetPixelFormat(run->format);
+    }
+    if (run->retained) {
+      if (i == 0) {
+        LCDsetRetainedMode(true);
+      }
+      LCDflush();
+    }
+    run->transport->wait();
+    St7735sStats stats = st7735sStats();
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%02zu_%s.ppm", dir, i, step->name);
+    const char* result;
+    if (mode == CHECK) {
+      int differing = st7735sComparePPM(path, run->tolerance);
+      if (differing != 0) {
+        failed++;
+      }
+      static char buf[32];
+      if (differing < 0) {
+        result = "MISSING";
+      } else if (differing > 0) {
+        snprintf(buf, sizeof(buf), "%d pixels differ", differing);
+        result = buf;
+      } else {
+        result = "ok";
+      }
+    } else if (st7735sWritePPM(path)) {
+      result = "written";
+    } else {
+      result = "can't write";
+      failed++;
+    }
+
+    printf("%-13s %8u %6u %6u %7u %9u  %s\n", step->name, stats.bytes,
+           stats.commands, stats.windows, stats.pixels,
+           stats.bytes / step->calls, result);
+  }
+
+  unsigned errors = st7735sErrors() + spiMockErrors();
+  if (errors > 0) {
+    printf("%u controller/wire errors\n", errors);
+  }
+  return failed + errors;
+}
+
+int main(int argc, char** argv) {
+  Mode mode = CHECK;
+  const char* dir = GOLDEN_DIR;
+  if (argc == 2 && strcmp(argv[1], "--update") == 0) {
+    mode = UPDATE;
+  } else if (argc == 3 && strcmp(argv[1], "--dump") == 0) {
+    mode = DUMP;
+    dir = argv[2];
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [--update | --dump <dir>]\n", argv[0]);
+    return 2;
+  }
+
+  spiMockSetSink(st7735sByte);
+
+  // the images are always written by the first run, the others have to match
+  int failed = 0;
+  for (size_t i = 0; i < RUN_COUNT; ++i) {
+    failed += runScene(&runs[i], i == 0 ? mode : CHECK, dir);
+  }
+
+  LcdBoardCost board = LCDbenchmarkBoard(nanoseconds);
+  printf("board image: %u bytes of flash (%u uncompressed), decoded in %u ns\n",
+         board.flash_bytes, LCD_PIXEL_WIDTH * LCD_PIXEL_HEIGHT * 2, board.decode_cycles);
+
+  return failed > 0;
+}
@@ -0,0 +1,91 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lcd.h"
+#include "lcd_transport.h"
+#include "spi_mock.h"
+
+// Replays the same drawing sequence through the bit-banged and the SPI/DMA
+// transports and checks that the controller would see the same byte stream.
+
+typedef struct {
+  uint16_t* bytes; // A0 level in bit 8
+  size_t size, capacity;
+} Recording;
+
+static Recording* current;
+
+static void record(bool is_data, uint8_t byte) {
+  if (current->size == current->capacity) {
+    current->capacity = current->capacity ? 2 * current->capacity : 4096;
+    current->bytes = realloc(current->bytes, current->capacity * sizeof(uint16_t));
+    if (!current->bytes) {
+      abort();
+    }
+  }
+  current->bytes[current->size++] = is_data << 8 | byte;
+}
+
+static void drawEverything(void) {
+  LCDconfigure();
+  LCDsetFont(&font8x16);
+  LCDclear();
+  LCDdrawBoard();
+
+  const char* text = "Score: 1234";
+  LCDgoto(0, 0);
+  for (const char* c = text; *c; ++c) {
+    LCDputchar(*c);
+  }
+
+  LCDpressFret(1);
+  LCDdrawNote(2, 40);
+  LCDmoveNoteVertical(2, 40, 3);
+  LCDmoveNoteVertical(2, 43, -2);
+  LCDremoveNote(2, 41);
+  LCDdrawNote(1, 125);
+  LCDmoveNoteVertical(1, 125, 5);
+  LCDremoveNote(1, 130);
+  LCDreleaseFret(1);
+  LCDdrawNote(4, 150);
+  LCDremoveNote(4, 150);
+}
+
+static unsigned run(const char* name, const LcdTransport* transport, Recording* out) {
+  spiMockReset();
+  current = out;
+  LCDsetTransport(transport);
+  drawEverything();
+  transport->wait();
+  unsigned errors = spiMockErrors();
+  printf("%-8s %9zu bytes, %u wire errors\n", name, out->size, errors);
+  return errors;
+}
+
+int main(void) {
+  Recording bitbang = {}, spi = {};
+  spiMockSetSink(record);
+
+  unsigned errors = run("bitbang", &lcd_bitbang_transport, &bitbang)
+                  + run("spi", &lcd_spi_transport, &spi);
+
+  size_t common = bitbang.size < spi.size ? bitbang.size : spi.size;
+  for (size_t i = 0; i < common; ++i) {
+    if (bitbang.bytes[i] != spi.bytes[i]) {
+      printf("streams differ at byte %zu: bitbang %03x, spi %03x\n",
+             i, bitbang.bytes[i], spi.bytes[i]);
+      return 1;
+    }
+  }
+  if (bitbang.size != spi.size) {
+    printf("streams differ in length\n");
+    return 1;
+  }
+  if (errors) {
+    return 1;
+  }
+  printf("streams identical\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <stddef.h>
+
+#include "spi_mock.h"
+
+static struct {
+  uint32_t cs, a0, sda, sck;
+  uint32_t shift;
+  uint32_t bits;
+  unsigned errors;
+  SpiMockSink sink;
+} mock = {.cs = 1, .a0 = 1};
+
+static void emit(uint8_t byte) {
+  if (mock.sink) {
+    mock.sink(mock.a0, byte);
+  }
+}
+
+void spiMockPin(LcdPin pin, uint32_t level) {
+  level = level != 0;
+  switch (pin) {
+    case LCD_PIN_CS:
+      if (level && mock.bits != 0) {
+        mock.errors++; // released in the middle of a byte
+      }
+      mock.bits = 0;
+      mock.cs = level;
+      break;
+    case LCD_PIN_A0:
+      mock.a0 = level;
+      break;
+    case LCD_PIN_SDA:
+      mock.sda = level;
+      break;
+    case LCD_PIN_SCK:
+      if (level && !mock.sck) { // rising edge latches SDA
+        if (mock.cs) {
+          mock.errors++;
+        } else {
+          mock.shift = mock.shift << 1 | mock.sda;
+          if (++mock.bits == 8) {
+            emit(mock.shift);
+            mock.bits = 0;
+          }
+        }
+      }
+      mock.sck = level;
+      break;
+    default:
+      break;
+  }
+}
+
+void spiMockFrame(uint32_t frame, uint32_t bits) {
+  if (mock.cs) {
+    mock.errors++;
+    return;
+  }
+  while (bits > 0) {
+    bits -= 8;
+    emit(frame >> bits);
+  }
+}
+
+void spiMockSetSink(SpiMockSink sink) {
+  mock.sink = sink;
+}
+
+unsigned spiMockErrors(void) {
+  return mock.errors;
+}
+
+void spiMockReset(void) {
+  SpiMockSink sink = mock.sink;
+  mock = (typeof(mock)){.cs = 1, .a0 = 1, .sink = sink};
+}
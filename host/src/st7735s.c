@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "st7735s.h"
+
+#define W ST7735S_WIDTH
+#define H ST7735S_HEIGHT
+
+// parameter bytes expected after each command lcd.c uses, -1 for RAMWR
+static int paramCount(uint8_t cmd) {
+  switch (cmd) {
+    case 0x11: case 0x13: case 0x29: return 0; // SLPOUT, NORON, DISPON
+    case 0x2A: case 0x2B: return 4; // CASET, RASET
+    case 0x2C: return -1; // RAMWR
+    case 0x33: return 6; // VSCRDEF
+    case 0x37: return 2; // VSCRSADD
+    case 0x36: case 0x3A: return 1; // MADCTL, COLMOD
+    case 0xB1: case 0xB2: return 3; // frame rate
+    case 0xB3: return 6;
+    case 0xB4: return 1; // inversion
+    case 0xC0: return 3; // power
+    case 0xC1: return 1;
+    case 0xC2: case 0xC3: case 0xC4: return 2;
+    case 0xC5: return 1; // VCOM
+    case 0xE0: case 0xE1: return 16; // gamma
+    default: return -2;
+  }
+}
+
+static struct {
+  uint16_t memory[H][W];
+
+  uint8_t cmd;
+  int expected; // parameter bytes left, -1 while writing memory
+  uint8_t params[16];
+  int nparams;
+
+  int xs, xe, ys, ye; // window
+  int x, y; // write cursor
+  uint32_t bits; // received pixel bits not yet written
+  int nbits;
+  uint8_t colmod;
+
+  bool scrolling;
+  int tfa, vsa, bfa, ssa; // in controller line numbers
+  uint8_t madctl;
+
+  St7735sStats stats;
+  uint32_t errors;
+} lcd;
+
+void st7735sReset(void) {
+  memset(&lcd, 0, sizeof(lcd));
+  lcd.xe = W - 1;
+  lcd.ye = H - 1;
+  lcd.vsa = H;
+  lcd.colmod = 0x05;
+}
+
+static uint16_t be16(const uint8_t* p) {
+  return p[0] << 8 | p[1];
+}
+
+static void command(uint8_t cmd) {
+  lcd.stats.commands++;
+  lcd.cmd = cmd;
+  lcd.nparams = 0;
+  lcd.nbits = 0; // an incomplete pixel is dropped
+  lcd.expected = paramCount(cmd);
+
+  if (lcd.expected == -2) {
+    lcd.errors++;
+    lcd.expected = 0;
+  } else if (cmd == 0x2C) {
+    lcd.x = lcd.xs;
+    lcd.y = lcd.ys;
+  } else if (cmd == 0x13) {
+    lcd.scrolling = false;
+  }
+}
+
+static void paramsDone(void) {
+  const uint8_t* p = lcd.params;
+  switch (lcd.cmd) {
+    case 0x2A:
+      lcd.xs = be16(p);
+      lcd.xe = be16(p + 2);
+      break;
+    case 0x2B:
+      lcd.ys = be16(p);
+      lcd.ye = be16(p + 2);
+      lcd.stats.windows++;
+      break;
+    case 0x33:
+      lcd.tfa = be16(p);
+      lcd.vsa = be16(p + 2);
+      lcd.bfa = be16(p + 4);
+      if (lcd.tfa + lcd.vsa + lcd.bfa != H) {
+        lcd.errors++;
+      }
+      break;
+    case 0x37:
+      lcd.ssa = be16(p);
+      lcd.scrolling = true;
+      break;
+    case 0x36:
+      lcd.madctl = p[0];
+      break;
+    case 0x3A:
+      lcd.colmod = p[0];
+      if (lcd.colmod != 0x03 && lcd.colmod != 0x05) {
+        lcd.errors++;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// the controller widens every channel by repeating its top bits
+static uint16_t from444(uint32_t p) {
+  uint16_t r = p >> 8, g = p >> 4 & 0xf, b = p & 0xf;
+  return (r << 1 | r >> 3) << 11 | (g << 2 | g >> 2) << 5 | (b << 1 | b >> 3);
+}
+
+static void writePixel(uint16_t pixel) {
+  if (lcd.x < W && lcd.y < H) {
+    lcd.memory[lcd.y][lcd.x] = pixel;
+  } else {
+    lcd.errors++;
+  }
+  lcd.stats.pixels++;
+  if (++lcd.x > lcd.xe) {
+    lcd.x = lcd.xs;
+    if (++lcd.y > lcd.ye) {
+      lcd.y = lcd.ys;
+    }
+  }
+}
+
+void st7735sByte(bool is_data, uint8_t byte) {
+  lcd.stats.bytes++;
+  if (!is_data) {
+    command(byte);
+    return;
+  }
+  if (lcd.expected == -1) {
+    int pixel_bits = lcd.colmod == 0x03 ? 12 : 16;
+    lcd.bits = lcd.bits << 8 | byte;
+    lcd.nbits += 8;
+    if (lcd.nbits >= pixel_bits) {
+      uint32_t pixel = lcd.bits >> (lcd.nbits - pixel_bits) & ((1u << pixel_bits) - 1);
+      lcd.nbits -= pixel_bits;
+      writePixel(pixel_bits == 12 ? from444(pixel) : pixel);
+    }
+  } else if (lcd.expected > 0) {
+    lcd.params[lcd.nparams++] = byte;
+    if (--lcd.expected == 0) {
+      paramsDone();
+    }
+  } else {
+    lcd.errors++;
+  }
+}
+
+uint16_t st7735sPixel(int x, int y) {
+  int row = y;
+  if (lcd.scrolling) {
+    // scrolling works on controller lines, which count from the other
+    // end of the screen when MADCTL.MY is set
+    bool flipped = lcd.madctl & 0x80;
+    int line = flipped ? H - 1 - y : y;
+    if (lcd.tfa <= line && line < lcd.tfa + lcd.vsa) {
+      int shown = lcd.tfa + (line - lcd.tfa + lcd.ssa - lcd.tfa) % lcd.vsa;
+      row = flipped ? H - 1 - shown : shown;
+    }
+  }
+  return lcd.memory[row][x];
+}
+
+St7735sStats st7735sStats(void) {
+  return lcd.stats;
+}
+
+void st7735sClearStats(void) {
+  memset(&lcd.stats, 0, sizeof(lcd.stats));
+}
+
+uint32_t st7735sErrors(void) {
+  return lcd.errors;
+}
+
+static void toRGB(uint16_t p, uint8_t rgb[3]) {
+  rgb[0] = (p >> 11) * 255 / 31;
+  rgb[1] = (p >> 5 & 0x3f) * 255 / 63;
+  rgb[2] = (p & 0x1f) * 255 / 31;
+}
+
+bool st7735sWritePPM(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  fprintf(f, "P6\n%d %d\n255\n", W, H);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      uint8_t rgb[3];
+      toRGB(st7735sPixel(x, y), rgb);
+      fwrite(rgb, 1, 3, f);
+    }
+  }
+  return fclose(f) == 0;
+}
+
+int st7735sComparePPM(const char* path, int tolerance) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return -1;
+  }
+  int w, h, max;
+  if (fscanf(f, "P6 %d %d %d", &w, &h, &max) != 3 || w != W || h != H || max != 255
+      || fgetc(f) == EOF) {
+    fclose(f);
+    return -1;
+  }
+  int differing = 0;
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      uint8_t rgb[3], expected[3];
+      toRGB(st7735sPixel(x, y), rgb);
+      if (fread(expected, 1, 3, f) != 3) {
+        fclose(f);
+        return -1;
+      }
+      for (int c = 0; c < 3; ++c) {
+        if (abs(rgb[c] - expected[c]) > tolerance) {
+          differing++;
+          break;
+        }
+      }
+    }
+  }
+  fclose(f);
+  return differing;
+}
@@ -1,7 +1,9 @@
 #ifndef DMA_UART_H
 #define DMA_UART_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef NDEBUG
 // debug, definition will be in .c file
@@ -19,14 +21,43 @@
 #endif
 
 
+// Messages wait in a queue of 64 while the UART is busy. Sending is only
+// safe from one context at a time: the main loop, or interrupts which can't
+// preempt each other.
+
+typedef enum {
+  DMA_DROP, // a message which doesn't fit is not sent (the default)
+  DMA_BLOCK, // the sender waits for room, never from an interrupt which the DMA one can't preempt
+} DmaOverflowPolicy;
+
+typedef struct {
+  uint32_t peak_depth; // most messages queued at once, with the one being sent
+  uint32_t drops; // messages dropped because the queue was full
+  uint32_t stalls; // sends which waited for room
+} DmaUartStats;
+
 // Initialization
 DECL_BEGIN void initDmaUart() DECL_END
+DECL_BEGIN void dmaSetOverflowPolicy(DmaOverflowPolicy policy) DECL_END
 
 // send/receive
 DECL_BEGIN void dmaSend(const char* buf, size_t len) DECL_END
 DECL_BEGIN void dmaSendWithCopy(const char* buf, size_t len) DECL_END
 DECL_BEGIN void dmaRecv(char* buf) DECL_END // size must be 1
 
+#ifndef NDEBUG
+// nothing is being sent or waiting to be
+bool dmaSendIdle();
+DmaUartStats dmaGetStats();
+#else
+inline bool dmaSendIdle() {
+  return false;
+}
+inline DmaUartStats dmaGetStats() {
+  return (DmaUartStats){0};
+}
+#endif
+
 // helper send macro that works only for compile-time constants
 #define DMA_DBG(MSG) dmaSend(MSG, sizeof(MSG) - 1)
 
@@ -78,5 +78,13 @@ bool isKeyHeld(KbKey key);
 // Holding a key only generates one press
 KbKey getNext();
 
+// Like getNext, also gives the clock's value when the press was detected,
+// if time isn't NULL. Presses detected together get the same time.
+KbKey getNextStamped(uint32_t* time);
+
+// Sets the clock the presses are stamped with, it's called from interrupts.
+// Without one all times are 0.
+void setKbClock(uint32_t (*clock)(void));
+
 
 #endif // KEYBOARD_H
\ No newline at end of file
@@ -4,6 +4,7 @@
 // Adapted from the basic LCD driver provided by Marcin Peczarski and Marcin Engel
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <fonts.h>
 
 // symbols exported by the original driver
@@ -16,11 +17,28 @@ void LCDputcharWrap(char c);
 // additional symbols from the basic driver, now exported
 void LCDsetFont(const font_t* font);
 
+// Like LCDputchar for every character, but only the characters which differ
+// from what is already shown are drawn, each run of them in a single window.
+// LCDputchar also skips characters which are already shown.
+void LCDputString(const char* text);
+
 /* Screen size in pixels, left top corner has coordinates (0, 0). */
 
 #define LCD_PIXEL_WIDTH   128
 #define LCD_PIXEL_HEIGHT  160
 
+// Span pipeline, used by everything below.
+// LCDbeginWindow selects a rectangle (inclusive, display coordinates, so
+// hardware scrolling is taken into account). Spans then fill it left to right,
+// top to bottom, a single span may cross any number of row ends.
+// Pixels past the end of the window are dropped.
+// With a DMA transport a span is sent in the background: its pixels must stay
+// unchanged until the next span, window or drawing call.
+void LCDbeginWindow(int x1, int y1, int x2, int y2);
+void LCDwriteSpan16(const uint16_t* pixels, int count);
+void LCDfillSpan(uint16_t color, int count);
+void LCDendWindow(void);
+
 // new functionality for drawing the game
 
 #define FRET_PRESS_Y 134
@@ -36,11 +54,123 @@ int LCDgetTextWidth();
 void LCDsetFullRectangle();
 void LCDdrawBoard();
 void LCDdrawNote(int col, int y);
+// any position, clipped to the screen, drawn over everything until the area is redrawn
 void LCDdrawNoteXY(int x, int y, NoteColor color);
 void LCDmoveNoteVertical(int col, int oldy, int deltay);
+// Removes the note (and its tail) at y, the notes it overlapped are drawn again.
 void LCDremoveNote(int col, int y);
+
+// A note as LCDdrawColumn draws it: y is its upper row. A hold note has a
+// tail of tail rows right above it, drawn as a solid bar. Once the head is
+// hit only the tail is left, y is then the row below its end.
+typedef struct {
+  int y;
+  int tail;
+  bool head;
+} LcdNote;
+
+// The notes of every column are remembered (to draw them again under
+// sprites, removed notes and the fret), up to this many per column.
+#define LCD_COLUMN_NOTES 128
+
+// Moves all notes of a column at once: notes are where they are after
+// moving by deltay, count is at most LCD_COLUMN_NOTES. Overlapping and
+// adjacent notes are drawn in one pass.
+// Tails only cost the rows their ends moved over.
+void LCDdrawColumn(int col, const LcdNote* notes, int count, int deltay);
+// Replaces the note at y (e.g. a hold note whose head was hit), redrawing
+// the rows either of them covers.
+void LCDreplaceNote(int col, int y, LcdNote note);
 void LCDpressFret(int col);
 void LCDreleaseFret(int col);
 bool LCDisFretPressed(int col);
 
+// Sprites: images blended over the board, the notes and each other.
+//
+// An image is a frame of a sprite sheet: a rectangle of the pixel and alpha
+// arrays written by extract_bmp.py. Alpha is given for each channel in the
+// RGB565 layout, like the note image. Without pixels the sprite's color is
+// used for every pixel (tinting), without alpha the image is opaque.
+typedef struct {
+  const uint16_t* pixels; // the whole sheet
+  const uint16_t* alpha;
+  int stride; // width of the sheet
+  int x, y, width, height; // the frame within the sheet
+} LcdImage;
+
+// the note, without pixels, to be tinted
+extern const LcdImage lcd_note_image;
+
+typedef struct {
+  const LcdImage* image;
+  int x, y; // upper left corner, any part of the sprite may be off the screen
+  int z; // sprites with a higher z are drawn over the others
+  uint16_t color; // for images without pixels
+} LcdSprite;
+
+#define LCD_MAX_SPRITES 8
+
+// Shown sprites are kept in z order (equal z: the one shown later is on top)
+// and composited by every drawing call, clipped to the screen on all edges.
+// They are always over the notes, and move along in scroll mode.
+// The sprite must stay alive while shown. Showing fails if the list is full.
+// To change anything but the position, hide the sprite and show it again.
+bool LCDshowSprite(LcdSprite* sprite);
+void LCDhideSprite(LcdSprite* sprite);
+// Redraws the area the sprite left and the one it entered, in one window
+// if they overlap. Moving to the same place redraws the sprite.
+void LCDmoveSprite(LcdSprite* sprite, int x, int y);
+
+// Hardware scrolling render mode: the board between the text and the fret row
+// is scrolled by the controller as one unit. LCDscrollBoard has to be called
+// once per tick before moving notes by the same deltay, LCDmoveNoteVertical
+// then only redraws the strip uncovered by the scroll and the fixed fret row.
+// Turning the mode off redraws an empty board in the scroll area.
+void LCDsetScrollMode(bool on);
+bool LCDisScrollMode();
+void LCDscrollBoard(int deltay);
+
+// Retained mode (needs LCD_FRAMEBUFFER, 40 KB of RAM): everything is drawn
+// into a framebuffer, and LCDflush sends the changed areas, merged so that
+// overlapping drawing is sent once. Call LCDflush once per frame.
+// With DMA the flush goes out while the next frame is drawn. Pixels drawn
+// meanwhile may go out with it, they are sent again by the next flush anyway.
+// Turning the mode on clears the screen, turning it off flushes.
+void LCDsetRetainedMode(bool on);
+bool LCDisRetainedMode();
+void LCDflush();
+
+// Format of the pixels sent to the controller, the geometry stays the same.
+// RGB444 sends 12 bits per pixel (3 bytes per 2 pixels) instead of 16,
+// colors are cut down from RGB565 when sent. LCDconfigure selects RGB565.
+typedef enum {
+  LCD_RGB565,
+  LCD_RGB444,
+} LcdPixelFormat;
+
+void LCDsetPixelFormat(LcdPixelFormat format);
+LcdPixelFormat LCDgetPixelFormat();
+
+// Cycles taken to compute one note's pixels with the old division-based
+// blend, the lookup-table blend and the precomputed sprites, and to blend
+// a note row in place (LCDblendRow in lcd_blend.h).
+// cycles is any free-running counter, e.g. the DWT cycle counter.
+typedef struct {
+  uint32_t divide;
+  uint32_t lookup;
+  uint32_t sprite;
+  uint32_t row_lookup;
+} LcdBlendCycles;
+
+LcdBlendCycles LCDbenchmarkBlend(uint32_t (*cycles)(void));
+
+// Bytes of flash taken by the compressed board image
+// and cycles taken to decode every one of its rows.
+typedef struct {
+  uint32_t flash_bytes;
+  uint32_t decode_cycles;
+} LcdBoardCost;
+
+LcdBoardCost LCDbenchmarkBoard(uint32_t (*cycles)(void));
+
 #endif // GUITAR_HERO_LCD_H
@@ -0,0 +1,23 @@
+#ifndef LCD_BLEND_H
+#define LCD_BLEND_H
+
+#include <stdint.h>
+
+// Blending of an RGB565 image over the board, used by lcd.c for the notes.
+//
+// The alpha is an RGB565 pixel too, with a separate alpha for each channel.
+// Every channel of the result is
+//   img * alpha / max + bg * (max - alpha) / max
+// with both terms rounded down, as the original driver computed it.
+
+// fills the lookup tables used by calculateAlpha, called from LCDconfigure
+void LCDinitBlendTables(void);
+
+// one pixel, with lookup tables instead of divisions
+uint16_t calculateAlpha(uint16_t bg_pixel, uint16_t img_pixel, uint16_t img_alpha);
+
+// Blends img over count pixels of row in place, alpha[i] applies to row[i],
+// bit for bit like the formula above (checked by host/src/blend_check.c).
+void LCDblendRow(uint16_t* row, uint16_t img_pixel, const uint16_t* alpha, int count);
+
+#endif // LCD_BLEND_H
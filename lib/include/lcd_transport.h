@@ -0,0 +1,36 @@
+#ifndef LCD_TRANSPORT_H
+#define LCD_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte pipe between lcd.c and the ST7735S.
+//
+// lcd.c only ever talks to the controller through one of these, so the wire
+// can be swapped without touching any drawing code. Everything is sent MSB
+// first, exactly as the original bit-banged driver did.
+//
+// pixels() and fill() may return before the data is on the wire (DMA).
+// The pixel buffer must then stay untouched until the next call into the
+// transport - every call waits for the previous transfer before doing anything.
+typedef struct {
+  void (*configure)(void); // clocks and pins, called once from LCDconfigure
+  void (*cs)(uint32_t bit); // chip select line level, 0 selects the controller
+  void (*command)(uint32_t cmd); // one byte with A0 low
+  void (*data)(uint32_t data, uint32_t bits); // bits is 8, 16, 24 or 32
+  void (*pixels)(const uint16_t* pixels, size_t count); // RGB565 run
+  void (*fill)(uint16_t color, size_t count); // the same RGB565 pixel count times
+  void (*wait)(void); // blocks until everything sent so far is on the wire
+} LcdTransport;
+
+// GPIO bit-banging on any four pins, no peripherals used
+extern const LcdTransport lcd_bitbang_transport;
+
+// hardware SPI, pixel runs are streamed with DMA in the background
+extern const LcdTransport lcd_spi_transport;
+
+// call before LCDconfigure, the default is lcd_bitbang_transport
+void LCDsetTransport(const LcdTransport* transport);
+
+#endif // LCD_TRANSPORT_H
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <assert.h>
+#include <stdint.h>
+
+// Debug builds record what the game does as 8-byte binary events instead of
+// formatting messages: an event is a single store into a ring buffer, which
+// traceFlush sends over the UART (dma_uart.c) in the background.
+// communicator/trace_decoder turns them back into text.
+//
+// Sent in memory order (little endian) an event is:
+//   byte 0     0x80 | event id, the high bit tells it apart from text messages
+//   byte 1     a
+//   bytes 2-3  b
+//   bytes 4-7  tick
+//
+// With NDEBUG all of it is a noop, like dma_uart.h.
+
+typedef enum {
+#define TRACE_EVENT(name, format) name,
+#include "trace_events.h"
+#undef TRACE_EVENT
+  TRACE_EVENT_COUNT,
+} TraceEvent;
+
+#define TRACE_MARK 0x80
+
+#define TRACE_PACK(id, a, b, tick) \
+  ((uint64_t)(tick) << 32 | (uint32_t)(uint16_t)(b) << 16 | (uint32_t)(uint8_t)(a) << 8 \
+   | TRACE_MARK | (id))
+
+#ifndef NDEBUG
+
+// 2 KB, about 2 seconds of UART at 9600 baud
+#define TRACE_SIZE 256
+static_assert(__builtin_popcount(TRACE_SIZE) == 1, "trace size must be a power of two");
+
+struct TraceRing {
+  uint64_t events[TRACE_SIZE];
+  uint32_t head; // written by trace
+  uint32_t tail; // sent, moved by traceFlush
+  uint32_t sending; // events handed to the DMA, from tail on
+  uint32_t dropped; // since the last TR_DROPPED
+  uint32_t tick; // stamped on every event
+};
+
+extern struct TraceRing trace_ring;
+
+// call from main "thread" only, events never wait for the UART:
+// when the ring is full they're only counted
+static inline void trace(TraceEvent id, uint8_t a, uint16_t b) {
+  uint32_t head = trace_ring.head;
+  if (head - trace_ring.tail == TRACE_SIZE) {
+    trace_ring.dropped++;
+    return;
+  }
+  trace_ring.events[head & (TRACE_SIZE - 1)] = TRACE_PACK(id, a, b, trace_ring.tick);
+  trace_ring.head = head + 1;
+}
+
+// the tick of the events recorded from now on
+static inline void setTraceTick(uint32_t tick) {
+  trace_ring.tick = tick;
+}
+
+// Hands the next events to the DMA when the UART is idle and takes back the
+// ones sent. Call it every loop, it never waits.
+void traceFlush();
+
+#else
+
+static inline void trace(TraceEvent id, uint8_t a, uint16_t b) {
+  (void)id;
+  (void)a;
+  (void)b;
+}
+
+static inline void setTraceTick(uint32_t tick) {
+  (void)tick;
+}
+
+static inline void traceFlush() {
+}
+
+#endif
+
+#endif // TRACE_H
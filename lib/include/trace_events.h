@@ -0,0 +1,17 @@
+// The trace events, included by trace.h and by the decoder in communicator/.
+// Every event carries the tick it happened in and two small arguments:
+// a (8 bits) and b (16 bits). In the formats, %a and %b print them unsigned,
+// %B prints b as a signed number.
+//
+// To add an event, add a line at the end, so old captures still decode.
+
+TRACE_EVENT(TR_DROPPED, "%b events dropped, the ring was full")
+TRACE_EVENT(TR_SPAWN, "note %b spawned in column %a")
+TRACE_EVENT(TR_DELETE, "note %b deleted in column %a")
+TRACE_EVENT(TR_MISS, "miss in column %a, %B ms off")
+TRACE_EVENT(TR_GOOD, "good in column %a, %B ms off")
+TRACE_EVENT(TR_PERFECT, "perfect in column %a, %B ms off")
+TRACE_EVENT(TR_NOTE, "setting note with octave %a and letter %b")
+TRACE_EVENT(TR_WAVE_LEN, "wave length changed to %b")
+TRACE_EVENT(TR_HOLD, "hold in column %a, held for %b ticks")
+TRACE_EVENT(TR_REPLAY, "%a bytes of the replay log follow, frame %b")
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stm32.h>
@@ -79,39 +80,25 @@ typedef struct {
 } SendQueueElem;
 
 #define SEND_QUEUE_SIZE 64
+static_assert(__builtin_popcount(SEND_QUEUE_SIZE) == 1, "send queue size must be a power of two");
 #define MAX_COPY_BUFFER_SIZE 128
 
-struct SendQueue {
+// Single producer, single consumer ring: the sending context only moves head,
+// the DMA interrupt only moves tail, so neither needs to lock the other out.
+// Both count up forever (an index is masked), head - tail is the number of
+// messages waiting, the one at tail is being sent while the stream is enabled.
+// Messages are only ever sent from the ring, so a finished transfer always
+// frees the one at tail.
+static struct SendQueue {
   SendQueueElem elems[SEND_QUEUE_SIZE];
   char buf_copies[SEND_QUEUE_SIZE][MAX_COPY_BUFFER_SIZE];
-  int size;
-  int start;
+  volatile uint32_t head; // written by the sender only
+  volatile uint32_t tail; // written by the interrupt only
+  DmaOverflowPolicy policy;
+  DmaUartStats stats; // written by the sender only
 } queue;
 
-char temp_buf[MAX_COPY_BUFFER_SIZE];
-
-#define QUEUE_GET(n) (queue.elems[(queue.start + n) % SEND_QUEUE_SIZE])
-#define QUEUE_COPY_GET(n) (queue.buf_copies[(queue.start + n) % SEND_QUEUE_SIZE])
-
-#define QUEUE_POP() \
-({ \
-  SendQueueElem* ret = &QUEUE_GET(0); \
-  queue.size--; \
-  queue.start++; \
-  ret; \
-})
-
-#define QUEUE_PUSH(buf, len) \
-  do { \
-    SendQueueElem* elem = &QUEUE_GET(queue.size); \
-    elem->buf = buf; \
-    elem->len = len; \
-    queue.size++; \
-  } while (false)
-
-static void queueSend(const char* buf, size_t len) {
-  QUEUE_PUSH(buf, len);
-}
+#define QUEUE_INDEX(n) ((n) & (SEND_QUEUE_SIZE - 1))
 
 static void forceSend(const char* buf, size_t len) {
   DMA1_Stream6->M0AR = (uint32_t)buf;
@@ -119,25 +106,77 @@ static void forceSend(const char* buf, size_t len) {
   DMA1_Stream6->CR |= DMA_SxCR_EN;
 }
 
+// nothing is being sent and no finished transfer is waiting for the interrupt
+static bool streamIdle() {
+  return (DMA1_Stream6->CR & DMA_SxCR_EN) == 0
+    && (DMA1->HISR & DMA_HISR_TCIF6) == 0;
+}
+
+// Waits for room for one more message or gives up, depending on the policy.
+// Returns the slot to write to, or false when the message is dropped.
+static bool reserveSlot(uint32_t* slot) {
+  uint32_t head = queue.head;
+  if (head - queue.tail == SEND_QUEUE_SIZE) {
+    if (queue.policy == DMA_DROP) {
+      queue.stats.drops++;
+      return false;
+    }
+    queue.stats.stalls++;
+    while (head - queue.tail == SEND_QUEUE_SIZE) {
+    }
+  }
+  *slot = head;
+  return true;
+}
+
+static void publish(uint32_t slot, const char* buf, size_t len) {
+  queue.elems[QUEUE_INDEX(slot)] = (SendQueueElem){buf, len};
+  // the message (and its copy) must be in memory before the interrupt can see it
+  __DMB();
+  queue.head = slot + 1;
+
+  uint32_t depth = slot + 1 - queue.tail;
+  if (depth > queue.stats.peak_depth) {
+    queue.stats.peak_depth = depth;
+  }
+  // the interrupt starts the next transfer when one finishes, if none is
+  // running it has to be woken up to start this one
+  if (streamIdle()) {
+    NVIC_SetPendingIRQ(DMA1_Stream6_IRQn);
+  }
+}
+
 void dmaSend(const char* buf, size_t len) {
-  if ((DMA1_Stream6->CR & DMA_SxCR_EN) == 0
-      && (DMA1->HISR & DMA_HISR_TCIF6) == 0) {
-    forceSend(buf, len);
-  } else {
-    queueSend(buf, len);
+  uint32_t slot;
+  if (reserveSlot(&slot)) {
+    publish(slot, buf, len);
   }
 }
 
 void dmaSendWithCopy(const char* buf, size_t len) {
-  if ((DMA1_Stream6->CR & DMA_SxCR_EN) == 0
-      && (DMA1->HISR & DMA_HISR_TCIF6) == 0) {
-    memcpy(temp_buf, buf, len);
-    forceSend(temp_buf, len);
-  } else {
-    char* copy_buf = QUEUE_COPY_GET(queue.size);
-    memcpy(copy_buf, buf, len);
-    queueSend(copy_buf, len);
+  uint32_t slot;
+  if (!reserveSlot(&slot)) {
+    return;
+  }
+  // longer messages are cut short rather than overrun the next copy
+  if (len > MAX_COPY_BUFFER_SIZE) {
+    len = MAX_COPY_BUFFER_SIZE;
   }
+  char* copy_buf = queue.buf_copies[QUEUE_INDEX(slot)];
+  memcpy(copy_buf, buf, len);
+  publish(slot, copy_buf, len);
+}
+
+bool dmaSendIdle() {
+  return streamIdle() && queue.head == queue.tail;
+}
+
+void dmaSetOverflowPolicy(DmaOverflowPolicy policy) {
+  queue.policy = policy;
+}
+
+DmaUartStats dmaGetStats() {
+  return queue.stats;
 }
 
 void dmaRecv(char* buf) { // size must be 1
@@ -178,21 +217,29 @@ void registerDmaUartHandler(HandlerPurpose type, DmaUartHandler handler) {
   } while (false)
 
 extern void DMA1_Stream6_IRQHandler() {
+  // read before the flags, so a transfer finishing in between is seen as finished
+  bool running = DMA1_Stream6->CR & DMA_SxCR_EN;
   // read which interrupts we should handle
   uint32_t isr = DMA1->HISR;
+  uint32_t tail = queue.tail;
+  const char* finished = NULL;
   if (isr & DMA_HISR_TCIF6) {
     // clear interrupt flag
     DMA1->HIFCR = DMA_HIFCR_CTCIF6;
 
-    if (queue.size > 0) {
-      SendQueueElem* to_send = QUEUE_POP();
-      forceSend(to_send->buf, to_send->len);
-      CALL_HANDLER(H_DMA_SEND_FINISH, to_send->buf);
-    } else {
-      CALL_HANDLER(H_DMA_SEND_FINISH, NULL);
-    }
+    finished = queue.elems[QUEUE_INDEX(tail)].buf;
+    queue.tail = ++tail;
+  } else if (running) {
+    // woken up by a sender while a transfer was running, it'll get its turn
+    return;
+  }
 
-    
+  if (queue.head != tail) {
+    SendQueueElem* to_send = &queue.elems[QUEUE_INDEX(tail)];
+    forceSend(to_send->buf, to_send->len);
+  }
+  if (isr & DMA_HISR_TCIF6) {
+    CALL_HANDLER(H_DMA_SEND_FINISH, finished);
   }
 }
 
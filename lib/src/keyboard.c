@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 #include <stm32.h>
 #include <gpio.h>
 #include <delay.h>
@@ -9,6 +10,18 @@
 int key_col = 0;
 int key_row = 0;
 
+// stamps the key presses, see setKbClock
+static uint32_t (*kb_clock)(void) = NULL;
+
+static uint32_t kbNow() {
+  return kb_clock ? kb_clock() : 0;
+}
+
+// The first press after all keys were released wakes up EXTI, but is only
+// scanned a timer period later. It's stamped with the time of the edge.
+static uint32_t edge_time;
+static bool first_scan = false;
+
 #define KB_GPIO GPIOC
 
 // All macros take row/col numbers from [1..4]
@@ -56,6 +69,8 @@ static void setAllColsTo(bool to) {
 }
 
 void EXTI9_5_IRQHandler() {
+  edge_time = kbNow();
+  first_scan = true;
   EXTI->IMR &= ~KB_ROW_PR_MASK;
 
   EXTI->PR |= 0;
@@ -96,6 +111,7 @@ static_assert(__builtin_popcount(KEY_BUF_SIZE) == 1, "key buf size must be a pow
 typedef unsigned char buf_ind_t;
 struct PressedKeyBuffer {
   KbKey keys[KEY_BUF_SIZE];
+  uint32_t times[KEY_BUF_SIZE]; // when each key was pressed
   uint32_t data;
   // data represents (assuming lowest bits go last):
   // buf_ind_t padding[2];
@@ -131,8 +147,12 @@ struct PressedKeyBuffer {
 #define SET_BUF_SIZE(what) SET_SIZE(key_buf.data, what)
 
 
-// call from main "thread" only
 KbKey getNext() {
+  return getNextStamped(NULL);
+}
+
+// call from main "thread" only
+KbKey getNextStamped(uint32_t* time) {
   uint32_t* memory = &key_buf.data;
   int retries = 0;
 
@@ -148,6 +168,7 @@ KbKey getNext() {
 
     // read key at read value
     KbKey rv = key_buf.keys[GET_START(memory_val)]; // indexing at key_buf.start
+    uint32_t rv_time = key_buf.times[GET_START(memory_val)];
 
 		// modify value, equivalent to:
     //   key_buf.start = (key_buf.start + 1) % KEY_BUF_SIZE;
@@ -164,6 +185,9 @@ KbKey getNext() {
       __DMB();
           
       // written, return success
+      if (time) {
+        *time = rv_time;
+      }
       return rv;
     }
     // buffer changed between read and write, retry
@@ -174,8 +198,9 @@ KbKey getNext() {
 }
 
 // only call from interrupt handler
-static void storeKeyPress(KbKey key) {
+static void storeKeyPress(KbKey key, uint32_t time) {
   key_buf.keys[(GET_BUF_START + GET_BUF_SIZE) % KEY_BUF_SIZE] = key;
+  key_buf.times[(GET_BUF_START + GET_BUF_SIZE) % KEY_BUF_SIZE] = time;
   // don't need synchronization as we can never get interrupted by getNext
   if (GET_BUF_SIZE == KEY_BUF_SIZE) {
     SET_BUF_START((GET_BUF_START + 1) % KEY_BUF_SIZE);
@@ -196,6 +221,8 @@ bool isKeyHeld(KbKey key) {
 }
 
 bool scanKeys() {
+  uint32_t now = first_scan ? edge_time : kbNow();
+  first_scan = false;
   uint16_t new_key_mask = 0;
   for (int i = 1; i <= N_COLS; ++i) {
     KB_SET_PIN(COL, i, false);
@@ -238,7 +265,7 @@ bool scanKeys() {
       uint16_t key_mask = MAKE_KEY_MASK(key);
       // only register press if it wasn't in the mask already
       if (!(pressed_key_mask & key_mask)) {
-        storeKeyPress(key);
+        storeKeyPress(key, now);
       }
       new_key_mask |= key_mask;
     }
@@ -247,6 +274,10 @@ bool scanKeys() {
   return pressed_key_mask != 0;
 }
 
+void setKbClock(uint32_t (*clock)(void)) {
+  kb_clock = clock;
+}
+
 void initKb() {
   static_assert(KB_ROW_PIN_MASK == KB_ROW_PR_MASK, 
     "Pin and PR masks different, make sure configuration is done properly before compiling");
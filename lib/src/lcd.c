@@ -1,12 +1,13 @@
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
 
 #include <delay.h>
 #include <fonts.h>
-#include <gpio.h>
-#include <lcd_board_def.h>
 
 #include "lcd.h" // quotation marks include the modified header
+#include "lcd_transport.h"
+#include "lcd_blend.h"
 
 /** 
   * The more advanced LCD driver (not only text mode) for 
@@ -16,29 +17,6 @@
   * and Marcin Engel.
   */
 
-/* 
- * Microcontroller pin definitions:
- * constants LCD_*_GPIO_N are port letter codes (A, B, C, ...),
- * constants LCD_*_PIN_N are the port output numbers (from 0 to 15),
- * constants GPIO_LCD_* are memory pointers,
- * constants PIN_LCD_* and RCC_LCD_* are bit masks. 
- */
-
-#define GPIO_LCD_CS   xcat(GPIO, LCD_CS_GPIO_N)
-#define GPIO_LCD_A0   xcat(GPIO, LCD_A0_GPIO_N)
-#define GPIO_LCD_SDA  xcat(GPIO, LCD_SDA_GPIO_N)
-#define GPIO_LCD_SCK  xcat(GPIO, LCD_SCK_GPIO_N)
-
-#define PIN_LCD_CS    (1U << LCD_CS_PIN_N)
-#define PIN_LCD_A0    (1U << LCD_A0_PIN_N)
-#define PIN_LCD_SDA   (1U << LCD_SDA_PIN_N)
-#define PIN_LCD_SCK   (1U << LCD_SCK_PIN_N)
-
-#define RCC_LCD_CS    xcat3(RCC_AHB1ENR_GPIO, LCD_CS_GPIO_N, EN)
-#define RCC_LCD_A0    xcat3(RCC_AHB1ENR_GPIO, LCD_A0_GPIO_N, EN)
-#define RCC_LCD_SDA   xcat3(RCC_AHB1ENR_GPIO, LCD_SDA_GPIO_N, EN)
-#define RCC_LCD_SCK   xcat3(RCC_AHB1ENR_GPIO, LCD_SCK_GPIO_N, EN)
-
 /* Some color definitions */
 
 #define LCD_COLOR_WHITE    0xFFFF
@@ -73,107 +51,166 @@ int LCDgetTextWidth() {
   return TextWidth;
 }
 
-/** Internal functions **/
+/* What each text cell shows, so unchanged characters aren't redrawn.
+0 marks a cell which was drawn over by something else. Sized for fonts
+down to 5x8 pixels, cells outside are always redrawn. */
 
-/* The following four functions are inlined and "if" statement is
-eliminated during optimization if the "bit" argument is a constant. */
+#define TEXT_MAX_LINES   (LCD_PIXEL_HEIGHT / 8)
+#define TEXT_MAX_COLUMNS (LCD_PIXEL_WIDTH / 5)
 
-static void CS(uint32_t bit) {
-  if (bit) {
-    GPIO_LCD_CS->BSRR = PIN_LCD_CS; /* Activate chip select line. */
-  }
-  else {
-    GPIO_LCD_CS->BSRR = PIN_LCD_CS << 16; /* Deactivate chip select line. */
+static char text_shown[TEXT_MAX_LINES][TEXT_MAX_COLUMNS];
+
+static char* shownChar(int line, int pos) {
+  if (0 <= line && line < TEXT_MAX_LINES && 0 <= pos && pos < TEXT_MAX_COLUMNS) {
+    return &text_shown[line][pos];
   }
+  return NULL;
 }
 
-static void A0(uint32_t bit) {
-  if (bit) {
-    GPIO_LCD_A0->BSRR = PIN_LCD_A0; /* Set data/command line to data. */
-  }
-  else {
-    GPIO_LCD_A0->BSRR = PIN_LCD_A0 << 16; /* Set data/command line to command. */
+// forgets the text cells which overlap the rectangle
+static void forgetText(int x1, int y1, int x2, int y2) {
+  // division rounds towards zero, which can only forget too much
+  int first_line = (y1 - YOffset) / CurrentFont->height;
+  int last_line  = (y2 - YOffset) / CurrentFont->height;
+  int first_pos  = (x1 - XOffset) / CurrentFont->width;
+  int last_pos   = (x2 - XOffset) / CurrentFont->width;
+  for (int line = first_line; line <= last_line; ++line) {
+    for (int pos = first_pos; pos <= last_pos; ++pos) {
+      char* shown = shownChar(line, pos);
+      if (shown) {
+        *shown = 0;
+      }
+    }
   }
 }
 
-static void SDA(uint32_t bit) {
-  if (bit) {
-    GPIO_LCD_SDA->BSRR = PIN_LCD_SDA; /* Set data bit one. */
-  }
-  else {
-    GPIO_LCD_SDA->BSRR = PIN_LCD_SDA << 16; /* Set data bit zero. */
+/** Internal functions **/
+
+#define IMIN(m1, m2) \
+  ({ \
+    int l = m1, r = m2; \
+    l > r ? r : l; \
+  })
+
+#define IMAX(m1, m2) \
+  ({ \
+    int l = m1, r = m2; \
+    l < r ? r : l; \
+  })
+
+
+/* Everything below goes through the transport, see lcd_transport.h */
+
+static const LcdTransport* transport = &lcd_bitbang_transport;
+
+void LCDsetTransport(const LcdTransport* new_transport) {
+  transport = new_transport;
+}
+
+/* Pixel format on the wire, see LCDsetPixelFormat. Everything is drawn
+in RGB565 and only converted here, on the way to the transport. */
+
+static LcdPixelFormat pixel_format = LCD_RGB565;
+
+// RGB444 packs 4 pixels into 3 16-bit words. Pixels which don't complete
+// a group wait for the next run, or for the end of the window (the next
+// command or CS(1)).
+static uint16_t pending[4];
+static int pending_count;
+
+#define PACK_WORDS (LCD_PIXEL_WIDTH / 4 * 3)
+static uint16_t packed[2][PACK_WORDS]; // in turns, DMA may still read one
+static int packed_buffer;
+
+static uint16_t to444(uint16_t pixel) {
+  return (pixel >> 12) << 8 | (pixel >> 7 & 0xf) << 4 | (pixel >> 1 & 0xf);
+}
+
+// fill repeats pixels[0] count times
+static void send444(const uint16_t* pixels, int count, bool fill) {
+  while (count > 0) {
+    // the other buffer than the one sent last, a pass which only leaves
+    // pixels pending doesn't send it
+    uint16_t* out = packed[packed_buffer ^ 1];
+    int words = 0;
+    while (count > 0 && words < PACK_WORDS) {
+      pending[pending_count++] = to444(*pixels);
+      pixels += !fill;
+      count--;
+      if (pending_count == 4) {
+        out[words++] = pending[0] << 4 | pending[1] >> 8;
+        out[words++] = pending[1] << 8 | pending[2] >> 4;
+        out[words++] = pending[2] << 12 | pending[3];
+        pending_count = 0;
+      }
+    }
+    if (words > 0) {
+      packed_buffer ^= 1;
+      transport->pixels(out, words);
+    }
   }
 }
 
-static void SCK(uint32_t bit) {
-  if (bit) {
-    GPIO_LCD_SCK->BSRR = PIN_LCD_SCK; /* Rising clock edge. */
+// Sends what is left of the last group. The last byte is padded with zero
+// bits, which the controller drops as an incomplete pixel.
+static void finish444(void) {
+  if (pending_count == 0) {
+    return;
   }
-  else {
-    GPIO_LCD_SCK->BSRR = PIN_LCD_SCK << 16; /* Falling clock edge. */
+  uint64_t bits = 0;
+  for (int i = 0; i < pending_count; ++i) {
+    bits = bits << 12 | pending[i];
+  }
+  int bytes = (pending_count * 12 + 7) / 8;
+  bits <<= bytes * 8 - pending_count * 12;
+  while (bytes-- > 0) {
+    transport->data(bits >> (bytes * 8) & 0xff, 8);
   }
+  pending_count = 0;
 }
 
-static void RCCconfigure(void) {
-  /* Enable GPIO clocks. */
-  RCC->AHB1ENR |= RCC_LCD_CS | RCC_LCD_A0 | RCC_LCD_SDA | RCC_LCD_SCK;
+static void sendPixels(const uint16_t* pixels, int count) {
+  if (pixel_format == LCD_RGB444) {
+    send444(pixels, count, false);
+  } else {
+    transport->pixels(pixels, count);
+  }
 }
 
-static void GPIOconfigure(void) {
-  CS(1); /* Set CS inactive. */
-  GPIOoutConfigure(GPIO_LCD_CS, LCD_CS_PIN_N, GPIO_OType_PP,
-                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
-
-  A0(1); /* Data are sent default. */
-  GPIOoutConfigure(GPIO_LCD_A0, LCD_A0_PIN_N, GPIO_OType_PP,
-                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
-
-  SDA(0);
-  GPIOoutConfigure(GPIO_LCD_SDA, LCD_SDA_PIN_N, GPIO_OType_PP,
-                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
-
-  SCK(0); /* Data bit is written on rising clock edge. */
-  GPIOoutConfigure(GPIO_LCD_SCK, LCD_SCK_PIN_N, GPIO_OType_PP,
-                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+static void sendFill(uint16_t color, int count) {
+  if (pixel_format == LCD_RGB444) {
+    send444(&color, count, true);
+  } else {
+    transport->fill(color, count);
+  }
 }
 
-static void LCDwriteSerial(uint32_t data, uint32_t length) {
-  uint32_t mask;
-
-  mask = 1U << (length - 1);
-  while (length > 0) {
-    SDA(data & mask); /* Set bit. */
-    --length;         /* Add some delay. */
-    SCK(1);           /* Rising edge writes bit. */
-    mask >>= 1;       /* Add some delay. */
-    SCK(0);           /* Falling edge ends the bit transmission. */
+static void CS(uint32_t bit) {
+  if (bit) {
+    finish444();
   }
+  transport->cs(bit);
 }
 
 static void LCDwriteCommand(uint32_t data) {
-  A0(0);
-  LCDwriteSerial(data, 8);
-  A0(1);
+  finish444();
+  transport->command(data);
 }
 
 static void LCDwriteData8(uint32_t data) {
-  /* A0(1); is already set */
-  LCDwriteSerial(data, 8);
+  transport->data(data, 8);
 }
 
 static void LCDwriteData16(uint32_t data) {
-  /* A0(1); is already set */
-  LCDwriteSerial(data, 16);
+  transport->data(data, 16);
 }
 
 static void LCDwriteData24(uint32_t data) {
-  /* A0(1); is already set */
-  LCDwriteSerial(data, 24);
+  transport->data(data, 24);
 }
 
 static void LCDwriteData32(uint32_t data) {
-  /* A0(1); is already set */
-  LCDwriteSerial(data, 32);
+  transport->data(data, 32);
 }
 
 void LCDsetRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
@@ -188,6 +225,279 @@ void LCDsetRectangle(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
   LCDwriteCommand(0x2C);
 }
 
+/* Hardware vertical scrolling state, see LCDsetScrollMode */
+
+// Display rows [scroll_top, scroll_top + scroll_height) form the scroll area.
+// Display row scroll_top + j shows memory row
+// scroll_top + (j - scroll_offset) mod scroll_height,
+// every other row shows the memory row with the same number.
+static bool scroll_on = false;
+static int scroll_top, scroll_height, scroll_offset;
+// rows uncovered by the last LCDscrollBoard (already redrawn) and its delta
+static int exposed_top, exposed_bottom, last_scroll;
+// Rows uncovered by every LCDscrollBoard since the column was last drawn,
+// moved along by the later ones, indexed by column like col_x. The board
+// was drawn over whatever tails were there.
+static int column_exposed_top[5], column_exposed_bottom[5];
+
+static int positiveMod(int a, int b) {
+  int r = a % b;
+  return r < 0 ? r + b : r;
+}
+
+// Returns the memory row that display row y is shown from, and in *rows
+// how many of the following display rows map to consecutive memory rows.
+static int mapRow(int y, int* rows) {
+  if (!scroll_on || y >= scroll_top + scroll_height) {
+    *rows = LCD_PIXEL_HEIGHT - y;
+    return y;
+  }
+  if (y < scroll_top) {
+    *rows = scroll_top - y;
+    return y;
+  }
+  int memory_j = positiveMod(y - scroll_top - scroll_offset, scroll_height);
+  int to_wrap = scroll_height - memory_j;
+  int to_area_end = scroll_top + scroll_height - y;
+  *rows = to_wrap < to_area_end ? to_wrap : to_area_end;
+  return scroll_top + memory_j;
+}
+
+/* Retained mode, see LCDsetRetainedMode */
+
+#ifdef LCD_FRAMEBUFFER
+
+// Windows are opened in the framebuffer instead of the controller, and
+// their areas remembered until LCDflush sends them.
+// The framebuffer is indexed by controller memory rows, so it follows
+// hardware scrolling exactly like the controller does.
+static bool retained = false;
+static uint16_t framebuffer[LCD_PIXEL_HEIGHT][LCD_PIXEL_WIDTH];
+
+typedef struct {
+  int x1, y1, x2, y2;
+} Area;
+
+// Sending two areas as one costs the pixels in between, sending them apart
+// costs another window setup (11 bytes) and more transport calls.
+#define MERGE_SLACK 32
+#define MAX_DIRTY 16
+
+static Area dirty[MAX_DIRTY];
+static int dirty_count;
+
+// the open framebuffer window and the next pixel written to it
+static struct {
+  int x1, x2;
+  int x, y;
+} fb;
+
+static int areaSize(Area a) {
+  return (a.x2 - a.x1 + 1) * (a.y2 - a.y1 + 1);
+}
+
+static Area mergeAreas(Area a, Area b) {
+  return (Area){
+    a.x1 < b.x1 ? a.x1 : b.x1,
+    a.y1 < b.y1 ? a.y1 : b.y1,
+    a.x2 > b.x2 ? a.x2 : b.x2,
+    a.y2 > b.y2 ? a.y2 : b.y2,
+  };
+}
+
+// overlapping areas always are, so nothing is sent twice
+static bool worthMerging(Area a, Area b) {
+  return areaSize(mergeAreas(a, b)) <= areaSize(a) + areaSize(b) + MERGE_SLACK;
+}
+
+static void markDirty(Area a) {
+  for (int i = 0; i < dirty_count;) {
+    if (worthMerging(dirty[i], a)) {
+      a = mergeAreas(dirty[i], a);
+      dirty[i] = dirty[--dirty_count];
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+  if (dirty_count == MAX_DIRTY) {
+    // no room, merge with the area which grows the least
+    int best = 0, best_growth = INT32_MAX;
+    for (int i = 0; i < dirty_count; ++i) {
+      int growth = areaSize(mergeAreas(dirty[i], a)) - areaSize(dirty[i]);
+      if (growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
+    }
+    a = mergeAreas(dirty[best], a);
+    dirty[best] = dirty[--dirty_count];
+    markDirty(a);
+    return;
+  }
+  dirty[dirty_count++] = a;
+}
+
+static void fbOpen(int x1, int y1, int x2, int y2) {
+  fb.x1 = fb.x = x1;
+  fb.x2 = x2;
+  fb.y = y1;
+  markDirty((Area){x1, y1, x2, y2});
+}
+
+static void fbPixels(const uint16_t* pixels, int count) {
+  while (count > 0) {
+    int run = IMIN(count, fb.x2 - fb.x + 1);
+    memcpy(&framebuffer[fb.y][fb.x], pixels, run * sizeof(uint16_t));
+    pixels += run;
+    count -= run;
+    fb.x += run;
+    if (fb.x > fb.x2) {
+      fb.x = fb.x1;
+      fb.y++;
+    }
+  }
+}
+
+static void fbFill(uint16_t color, int count) {
+  while (count > 0) {
+    int run = IMIN(count, fb.x2 - fb.x + 1);
+    for (int i = 0; i < run; ++i) {
+      framebuffer[fb.y][fb.x + i] = color;
+    }
+    count -= run;
+    fb.x += run;
+    if (fb.x > fb.x2) {
+      fb.x = fb.x1;
+      fb.y++;
+    }
+  }
+}
+
+#else
+
+static const bool retained = false;
+
+static void fbOpen(int x1, int y1, int x2, int y2) {
+  (void)x1, (void)y1, (void)x2, (void)y2;
+}
+
+static void fbPixels(const uint16_t* pixels, int count) {
+  (void)pixels, (void)count;
+}
+
+static void fbFill(uint16_t color, int count) {
+  (void)color, (void)count;
+}
+
+#endif // LCD_FRAMEBUFFER
+
+// Windows are filled top to bottom with spans (LCDwriteSpan16, LCDfillSpan),
+// the controller window is set only as often as the scroll area requires.
+// Assumes CS(0).
+static struct {
+  int x1, x2, width;
+  int y, y2; // first row not covered by an opened controller window and the last row
+  int pixels_left; // in the currently open controller window
+} rect;
+
+static void beginRect(int x1, int y1, int x2, int y2) {
+  forgetText(x1, y1, x2, y2);
+  rect.x1 = x1;
+  rect.x2 = x2;
+  rect.width = x2 - x1 + 1;
+  rect.y = y1;
+  rect.y2 = y2;
+  rect.pixels_left = 0;
+}
+
+// opens a controller window at row rect.y, as tall as the memory rows allow
+static void openWindow(void) {
+  int rows;
+  int memory_y = mapRow(rect.y, &rows);
+  if (rows > rect.y2 - rect.y + 1) {
+    rows = rect.y2 - rect.y + 1;
+  }
+  if (retained) {
+    fbOpen(rect.x1, memory_y, rect.x2, memory_y + rows - 1);
+  } else {
+    LCDsetRectangle(rect.x1, memory_y, rect.x2, memory_y + rows - 1);
+  }
+  rect.y += rows;
+  rect.pixels_left = rows * rect.width;
+}
+
+// call between rows instead of sending one, that row is left as it is
+static void skipRow(void) {
+  rect.y -= rect.pixels_left / rect.width - 1;
+  rect.pixels_left = 0;
+}
+
+void LCDbeginWindow(int x1, int y1, int x2, int y2) {
+  CS(0);
+  beginRect(x1, y1, x2, y2);
+}
+
+void LCDendWindow(void) {
+  CS(1);
+}
+
+// the runs are cut only where the window has to be reopened
+void LCDwriteSpan16(const uint16_t* pixels, int count) {
+  while (count > 0) {
+    if (rect.pixels_left == 0) {
+      if (rect.y > rect.y2) {
+        return; // past the window
+      }
+      openWindow();
+    }
+    int run = count < rect.pixels_left ? count : rect.pixels_left;
+    if (retained) {
+      fbPixels(pixels, run);
+    } else {
+      sendPixels(pixels, run);
+    }
+    pixels += run;
+    count -= run;
+    rect.pixels_left -= run;
+  }
+}
+
+void LCDfillSpan(uint16_t color, int count) {
+  while (count > 0) {
+    if (rect.pixels_left == 0) {
+      if (rect.y > rect.y2) {
+        return;
+      }
+      openWindow();
+    }
+    int run = count < rect.pixels_left ? count : rect.pixels_left;
+    if (retained) {
+      fbFill(color, run);
+    } else {
+      sendFill(color, run);
+    }
+    count -= run;
+    rect.pixels_left -= run;
+  }
+}
+
+static void fillRect(int x1, int y1, int x2, int y2, uint16_t color) {
+  beginRect(x1, y1, x2, y2);
+  LCDfillSpan(color, (x2 - x1 + 1) * (y2 - y1 + 1));
+}
+
+// Rows are built in these two buffers in turns. A span may still be read by
+// DMA after LCDwriteSpan16 returns, but the next span waits for it, so a
+// buffer is free again once the other one has been handed to LCDwriteSpan16.
+static uint16_t row_buffers[2][LCD_PIXEL_WIDTH];
+static int row_buffer;
+
+static uint16_t* nextRowBuffer(void) {
+  row_buffer ^= 1;
+  return row_buffers[row_buffer];
+}
+
 static void LCDcontrollerConfigure(void) {
   /* Activate chip select */
   CS(0);
@@ -255,54 +565,112 @@ static void LCDcontrollerConfigure(void) {
   CS(1);
 }
 
+/* Digits change all the time (score), so they are kept expanded
+to RGB565 in the current colors. Sized for fonts up to 8x16. */
+
+#define DIGIT_MAX_SIZE (8 * 16)
+
+static uint16_t digit_glyphs[10][DIGIT_MAX_SIZE];
+static bool digits_cached;
+
+static void expandGlyphRow(uint16_t* out, unsigned c, int i) {
+  uint16_t w = CurrentFont->table[(c - FIRST_CHAR) * CurrentFont->height + i];
+  for (int j = 0; j < CurrentFont->width; ++j, w >>= 1) {
+    out[j] = w & 1 ? TextColor : BackColor;
+  }
+}
+
+static void cacheDigits(void) {
+  digits_cached = CurrentFont->width * CurrentFont->height <= DIGIT_MAX_SIZE;
+  if (!digits_cached) {
+    return;
+  }
+  for (int d = 0; d < 10; ++d) {
+    for (int i = 0; i < CurrentFont->height; ++i) {
+      expandGlyphRow(&digit_glyphs[d][i * CurrentFont->width], '0' + d, i);
+    }
+  }
+}
+
 static void LCDsetColors(uint16_t text, uint16_t back) {
   TextColor = text;
   BackColor = back;
+  cacheDigits();
 }
 
-static void LCDdrawChar(unsigned c) {
-  uint16_t const *p;
-  uint16_t x, y, w;
-  int      i, j;
+// Draws n characters at the current position in one window, a row of all
+// of them at a time. Assumes all of them are printable and fit in the line.
+static void drawTextRun(const char* text, int n) {
+  int width = CurrentFont->width;
+  int y = YOffset + CurrentFont->height * Line;
+  int x = XOffset + width * Position;
 
   CS(0);
-  y = YOffset + CurrentFont->height * Line;
-  x = XOffset + CurrentFont->width  * Position;
-  LCDsetRectangle(x, y, x + CurrentFont->width - 1, y + CurrentFont->height - 1);
-  p = &CurrentFont->table[(c - FIRST_CHAR) * CurrentFont->height];
-  for (i = 0; i < CurrentFont->height; ++i) {
-    for (j = 0, w = p[i]; j < CurrentFont->width; ++j, w >>= 1) {
-      LCDwriteData16(w & 1 ? TextColor : BackColor);
+  beginRect(x, y, x + n * width - 1, y + CurrentFont->height - 1);
+  for (int i = 0; i < CurrentFont->height; ++i) {
+    uint16_t* row = nextRowBuffer();
+    for (int k = 0; k < n; ++k) {
+      unsigned c = text[k];
+      if (digits_cached && '0' <= c && c <= '9') {
+        memcpy(&row[k * width], &digit_glyphs[c - '0'][i * width], width * sizeof(uint16_t));
+      } else {
+        expandGlyphRow(&row[k * width], c, i);
+      }
     }
+    LCDwriteSpan16(row, n * width);
   }
   CS(1);
+
+  for (int k = 0; k < n; ++k) {
+    char* shown = shownChar(Line, Position + k);
+    if (shown) {
+      *shown = text[k];
+    }
+  }
 }
 
+static bool isShown(char c, int pos) {
+  char* shown = shownChar(Line, pos);
+  return shown && *shown == c;
+}
+
+static void LCDdrawChar(unsigned c) {
+  char ch = c;
+  if (!isShown(ch, Position)) {
+    drawTextRun(&ch, 1);
+  }
+}
+
+static void initBlending(void);
+static void forgetSprites(void);
+
 /** Public interface implementation **/
 
 void LCDconfigure() {
-  /* See Errata, 2.1.6 Delay after an RCC peripheral clock enabling */
-  RCCconfigure();
   /* Initialize global variables. */
   LCDsetFont(&LCD_DEFAULT_FONT);
   LCDsetColors(LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+  scroll_on = false;
+  pixel_format = LCD_RGB565;
+  pending_count = 0;
+#ifdef LCD_FRAMEBUFFER
+  retained = false;
+#endif
+  initBlending();
   /* Initialize hardware. */
-  GPIOconfigure();
+  transport->configure();
   LCDcontrollerConfigure();
   LCDclear();
 }
 
+// clears notes and sprites too
 void LCDclear() {
-  int i, j;
-
+  forgetSprites();
   CS(0);
-  LCDsetRectangle(0, 0, LCD_PIXEL_WIDTH - 1, LCD_PIXEL_HEIGHT - 1);
-  for (i = 0; i < LCD_PIXEL_WIDTH; ++i) {
-    for (j = 0; j < LCD_PIXEL_HEIGHT; ++j) {
-      LCDwriteData16(BackColor);
-    }
-  }
+  fillRect(0, 0, LCD_PIXEL_WIDTH - 1, LCD_PIXEL_HEIGHT - 1, BackColor);
   CS(1);
+  // which is what spaces look like
+  memset(text_shown, ' ', sizeof(text_shown));
 
   LCDgoto(0, 0);
 }
@@ -329,6 +697,42 @@ void LCDputchar(char c) {
   }
 }
 
+static bool isPrintable(char c) {
+  return c >= FIRST_CHAR && c <= LAST_CHAR;
+}
+
+void LCDputString(const char* text) {
+  while (*text) {
+    // the characters which can be drawn in one go
+    int n = 0;
+    while (isPrintable(text[n]) &&
+           Line >= 0 && Line < TextHeight &&
+           Position + n >= 0 && Position + n < TextWidth) {
+      n++;
+    }
+    if (n == 0) {
+      LCDputchar(*text++);
+      continue;
+    }
+    // only the changed ones are drawn, each run of them in its own window
+    for (int i = 0; i < n;) {
+      if (isShown(text[i], Position)) {
+        i++;
+        Position++;
+        continue;
+      }
+      int changed = 1;
+      while (i + changed < n && !isShown(text[i + changed], Position + changed)) {
+        changed++;
+      }
+      drawTextRun(text + i, changed);
+      i += changed;
+      Position += changed;
+    }
+    text += n;
+  }
+}
+
 void LCDputcharWrap(char c) {
   /* Check if, there is room for the next character,
   but does not wrap on white character. */
@@ -348,15 +752,40 @@ void LCDsetFont(const font_t *font) {
   XOffset = (LCD_PIXEL_WIDTH  - TextWidth  * CurrentFont->width)  / 2;
   // don't have the space for padding
   YOffset = 0; // (LCD_PIXEL_HEIGHT - TextHeight * CurrentFont->height) / 2;
+  memset(text_shown, 0, sizeof(text_shown));
+  cacheDigits();
 }
 
 // Advanced interface implementation
 
-#define BSIZE (LCD_PIXEL_WIDTH * LCD_PIXEL_HEIGHT)
-static const uint16_t board_pixels[BSIZE] = {
-  #include "board.txt"
+// The board image, compressed by extract_bmp.py: every distinct row is stored
+// once as (length, color) runs covering the whole width, and board_rows holds
+// the index in board_runs of each row's first run.
+static const uint16_t board_runs[] = {
+  #include "board_runs.txt"
+};
+
+static const uint16_t board_rows[LCD_PIXEL_HEIGHT] = {
+  #include "board_rows.txt"
 };
 
+// decodes pixels [x, x + width) of board row y into out
+static void decodeBoardRow(uint16_t* out, int x, int width, int y) {
+  const uint16_t* run = &board_runs[board_rows[y]];
+  int run_end = run[0];
+  while (run_end <= x) {
+    run += 2;
+    run_end += run[0];
+  }
+  for (int end = x + width; x < end; ++x) {
+    if (x == run_end) {
+      run += 2;
+      run_end += run[0];
+    }
+    *out++ = run[1];
+  }
+}
+
 // colors picked in gimp and exported to bmp
 #define LCD_BETTER_RED     0xc000
 #define LCD_BETTER_BLUE    0x27f
@@ -370,12 +799,36 @@ void LCDsetFullRectangle() {
   LCDsetRectangle(0, BOARD_FIRST_PIXEL, LCD_PIXEL_WIDTH - 1, LCD_PIXEL_HEIGHT - 1);
 }
 
+static bool spritesCover(int x1, int x2, int y);
+static const uint16_t* overlaySprites(uint16_t* buf, const uint16_t* row, int x, int width, int y);
+static void forgetNotes(void);
+
+// Assumes CS(0)
+// Identical rows are decoded once and sent from the same buffer,
+// unless sprites are drawn over them.
+static void drawBoardRows(int y1, int y2) {
+  beginRect(0, y1, LCD_PIXEL_WIDTH - 1, y2);
+  uint16_t* row = NULL;
+  bool overlaid = false;
+  for (int y = y1; y <= y2; ++y) {
+    bool covered = spritesCover(0, LCD_PIXEL_WIDTH - 1, y);
+    if (y == y1 || covered || overlaid || board_rows[y] != board_rows[y - 1]) {
+      row = nextRowBuffer();
+      decodeBoardRow(row, 0, LCD_PIXEL_WIDTH, y);
+    }
+    if (covered) {
+      overlaySprites(row, row, 0, LCD_PIXEL_WIDTH, y);
+    }
+    overlaid = covered;
+    LCDwriteSpan16(row, LCD_PIXEL_WIDTH);
+  }
+}
+
+// the notes are drawn over
 void LCDdrawBoard() {
+  forgetNotes();
   CS(0);
-  LCDsetFullRectangle();
-  for (int i = LCD_PIXEL_WIDTH * BOARD_FIRST_PIXEL; i < BSIZE; ++i) {
-    LCDwriteData16(board_pixels[i]);
-  }
+  drawBoardRows(BOARD_FIRST_PIXEL, LCD_PIXEL_HEIGHT - 1);
   CS(1);
   LCDgoto(0, 0);
 }
@@ -397,18 +850,6 @@ static const uint16_t color_map[4] = {
   LCD_BETTER_RED
 };
 
-#define IMIN(m1, m2) \
-  ({ \
-    int l = m1, r = m2; \
-    l > r ? r : l; \
-  })
-
-#define IMAX(m1, m2) \
-  ({ \
-    int l = m1, r = m2; \
-    l < r ? r : l; \
-  })
-
 #define GET_RED(pixel) ((pixel & LCD_COLOR_RED) >> 11)
 #define GET_GREEN(pixel) ((pixel & LCD_COLOR_GREEN) >> 5)
 #define GET_BLUE(pixel) (pixel & LCD_COLOR_BLUE)
@@ -464,9 +905,9 @@ static_assert(SHIFT_BLUE(GET_BLUE(LCD_COLOR_WHITE)) == LCD_COLOR_BLUE, "bad blue
 #define MAX_GREEN GET_GREEN(LCD_COLOR_GREEN)
 #define MAX_BLUE GET_BLUE(LCD_COLOR_BLUE)
 
-uint16_t color_pixel = 0;
-
-uint16_t calculateAlpha(uint16_t bg_pixel, uint16_t img_pixel, uint16_t img_alpha) {
+// The original blend, kept as the reference for LCDbenchmarkBlend,
+// see lcd_blend.c for the ones in use.
+static uint16_t calculateAlphaDivide(uint16_t bg_pixel, uint16_t img_pixel, uint16_t img_alpha) {
   // make calculations in 32-bit signed ints to minimize precision loss
 
   int32_t board_r = GET_RED(bg_pixel);
@@ -492,121 +933,278 @@ uint16_t calculateAlpha(uint16_t bg_pixel, uint16_t img_pixel, uint16_t img_alph
   return SHIFT_RED(pixel_r) | SHIFT_GREEN(pixel_g) | SHIFT_BLUE(pixel_b);
 }
 
-#define BOARD_INDEX(x, y) ((y) * LCD_PIXEL_WIDTH + (x))
+static const int col_x[5] = {-1, 0, 33, 65, 95};
+
+static const NoteColor col_color[5] = {-1, N_RED, N_YELLOW, N_GREEN, N_BLUE};
+
+// Most of the board consists of copies of a single row (the empty highway).
+// Every note blended over that row is computed once in initBlending,
+// so note rows over such board rows are just copied to the LCD.
+#define HIGHWAY_ROW (FRET_PRESS_Y - 1)
+
+static bool board_row_plain[LCD_PIXEL_HEIGHT];
+static uint16_t highway_row[LCD_PIXEL_WIDTH];
+static uint16_t note_sprites[5][NOTE_SIZE]; // indexed by column, like col_x
+
+// The pressed fret of every column blended over the board, so while a fret is
+// held (most of the time during play) rows around it need no blending either.
+static uint16_t pressed_frets[5][NOTE_SIZE]; // indexed by column, like col_x
+
+// Tails of hold notes are a bar in the middle of the column, the same solid
+// pixels on every row, so they are blended once here and then only copied.
+#define TAIL_WIDTH 8
+#define TAIL_X ((NOTE_WIDTH - TAIL_WIDTH) / 2)
+#define TAIL_ALPHA 0xc618 // about 3/4 of every channel
+
+static uint16_t tail_rows[5][NOTE_WIDTH]; // the highway with the bar, indexed by column
+
+static void initBlending(void) {
+  LCDinitBlendTables();
+
+  // identical rows share their runs
+  decodeBoardRow(highway_row, 0, LCD_PIXEL_WIDTH, HIGHWAY_ROW);
+  for (int y = 0; y < LCD_PIXEL_HEIGHT; ++y) {
+    board_row_plain[y] = board_rows[y] == board_rows[HIGHWAY_ROW];
+  }
+
+  for (int col = 1; col <= 4; ++col) {
+    uint16_t color = color_map[col_color[col]];
+    for (int py = 0; py < NOTE_HEIGHT; ++py) {
+      for (int px = 0; px < NOTE_WIDTH; ++px) {
+        int index = py * NOTE_WIDTH + px;
+        note_sprites[col][index] =
+          calculateAlpha(highway_row[col_x[col] + px], color, note_pixels[index]);
+      }
+      uint16_t* fret_row = &pressed_frets[col][py * NOTE_WIDTH];
+      decodeBoardRow(fret_row, col_x[col], NOTE_WIDTH, FRET_PRESS_Y + py);
+      LCDblendRow(fret_row, color, &note_pixels[py * NOTE_WIDTH], NOTE_WIDTH);
+    }
+    memcpy(tail_rows[col], &highway_row[col_x[col]], NOTE_WIDTH * sizeof(uint16_t));
+    for (int px = TAIL_X; px < TAIL_X + TAIL_WIDTH; ++px) {
+      tail_rows[col][px] = calculateAlpha(highway_row[col_x[col] + px], color, TAIL_ALPHA);
+    }
+  }
+}
+
+static bool inFretBand(int y) {
+  return FRET_PRESS_Y <= y && y < FRET_PRESS_Y + NOTE_HEIGHT;
+}
 
-static uint16_t getBoardPixelWhenFretPressed(int board_x, int board_y, int col_offset) {
-  uint16_t board_pixel = board_pixels[BOARD_INDEX(board_x, board_y)];
+// blends row py of a note in column col's color over row, in place
+static void blendNoteRow(uint16_t* row, int col, int py) {
+  uint16_t color = color_map[col_color[col]];
+  LCDblendRow(row, color, &note_pixels[py * NOTE_WIDTH], NOTE_WIDTH);
+}
 
-  if (FRET_PRESS_Y <= board_y && board_y < FRET_PRESS_Y + 20) {
-    int fret_x = col_offset;
-    int fret_y = board_y - FRET_PRESS_Y;
+// Sprites
 
-    int fret_index = fret_y * NOTE_WIDTH + fret_x;
+const LcdImage lcd_note_image = {
+  .alpha = note_pixels,
+  .stride = NOTE_WIDTH,
+  .width = NOTE_WIDTH,
+  .height = NOTE_HEIGHT,
+};
 
-    uint16_t fret_alpha = note_pixels[fret_index];
-    uint16_t fret_pixel = color_pixel;
+// shown sprites, lowest z first
+static LcdSprite* sprites[LCD_MAX_SPRITES];
+static int sprite_count;
 
-    return calculateAlpha(board_pixel, fret_pixel, fret_alpha);
+static bool spriteCovers(const LcdSprite* sprite, int x1, int x2, int y) {
+  const LcdImage* image = sprite->image;
+  return sprite->y <= y && y < sprite->y + image->height
+    && sprite->x <= x2 && x1 < sprite->x + image->width;
+}
+
+static bool spritesCover(int x1, int x2, int y) {
+  for (int i = 0; i < sprite_count; ++i) {
+    if (spriteCovers(sprites[i], x1, x2, y)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Draws the part of sprite on display row y between x1 and x2 over row,
+// which holds the pixels from x1 on. Assumes the sprite covers the row.
+static void blendSpriteRow(uint16_t* row, int x1, int x2, int y, const LcdSprite* sprite) {
+  const LcdImage* image = sprite->image;
+  int from = IMAX(x1, sprite->x);
+  int to = IMIN(x2, sprite->x + image->width - 1);
+  int count = to - from + 1;
+  int offset = (image->y + y - sprite->y) * image->stride + image->x + from - sprite->x;
+  uint16_t* out = &row[from - x1];
+
+  if (!image->alpha && !image->pixels) {
+    for (int i = 0; i < count; ++i) {
+      out[i] = sprite->color;
+    }
+  } else if (!image->alpha) {
+    memcpy(out, &image->pixels[offset], count * sizeof(uint16_t));
+  } else if (!image->pixels) {
+    LCDblendRow(out, sprite->color, &image->alpha[offset], count);
   } else {
-    return board_pixel;
+    for (int i = 0; i < count; ++i) {
+      out[i] = calculateAlpha(out[i], image->pixels[offset + i], image->alpha[offset + i]);
+    }
+  }
+}
+
+// Draws the sprites on display row y over the width pixels of row starting
+// at x. Returns row if no sprite is there, so without sprites drawing costs
+// nothing more, otherwise buf (row is copied there first unless it is buf).
+static const uint16_t* overlaySprites(uint16_t* buf, const uint16_t* row, int x, int width, int y) {
+  for (int i = 0; i < sprite_count; ++i) {
+    if (spriteCovers(sprites[i], x, x + width - 1, y)) {
+      if (row != buf) {
+        memcpy(buf, row, width * sizeof(uint16_t));
+        row = buf;
+      }
+      blendSpriteRow(buf, x, x + width - 1, y, sprites[i]);
+    }
   }
+  return row;
 }
 
-// call this before drawing notes
-void LCDsetColorPixel(NoteColor color) {
-  color_pixel = color_map[color];
+// Where the notes of every column are, as the drawing calls left them,
+// so the areas sprites leave can be drawn with the notes under them.
+static LcdNote column_notes[5][LCD_COLUMN_NOTES]; // indexed by column, like col_x
+static int column_note_count[5];
+
+static void rememberNote(int col, LcdNote note) {
+  assert(column_note_count[col] < LCD_COLUMN_NOTES);
+  if (column_note_count[col] < LCD_COLUMN_NOTES) {
+    column_notes[col][column_note_count[col]++] = note;
+  }
 }
 
-// x,y - screen coords; px,py - note coords
-typedef uint16_t (*PixelCalculator)(int x, int y, int px, int py);
+// the remembered note at y, NULL if there's none
+static LcdNote* findNote(int col, int y) {
+  for (int i = 0; i < column_note_count[col]; ++i) {
+    if (column_notes[col][i].y == y) {
+      return &column_notes[col][i];
+    }
+  }
+  return NULL;
+}
 
+static void forgetNote(int col, int y) {
+  LcdNote* note = findNote(col, y);
+  if (note) {
+    *note = column_notes[col][--column_note_count[col]];
+  }
+}
 
-PixelCalculator makeDrawer(bool isFretPressed) {
-  uint16_t lambda(int x, int y, int px, int py) {
-    int index = py * NOTE_WIDTH + px;
-    uint16_t alpha = note_pixels[index];
+// a tail covers the tail rows right above the head (or where it was)
+static int tailTop(LcdNote note) {
+  return note.y - note.tail;
+}
 
-    int board_x = x + px;
-    int board_y = y + py;
-    int board_index = board_y * LCD_PIXEL_WIDTH + board_x;
+static int tailBottom(LcdNote note) {
+  return note.y - 1;
+}
 
-    uint16_t board_pixel = board_pixels[board_index];
+static bool headCovers(LcdNote note, int y) {
+  return note.head && note.y <= y && y < note.y + NOTE_HEIGHT;
+}
 
-    return calculateAlpha(board_pixel, color_pixel, alpha);
-  } // lambda
+static bool tailCovers(LcdNote note, int y) {
+  return note.tail > 0 && tailTop(note) <= y && y <= tailBottom(note);
+}
 
-  uint16_t lambdaPressed(int x, int y, int px, int py) {
-    int index = py * NOTE_WIDTH + px;
-    uint16_t alpha = note_pixels[index];
+static int noteTop(LcdNote note) {
+  int top = note.head ? note.y : LCD_PIXEL_HEIGHT;
+  return note.tail > 0 ? IMIN(top, tailTop(note)) : top;
+}
 
-    int board_x = x + px;
-    int board_y = y + py;
+static int noteBottom(LcdNote note) {
+  int bottom = note.tail > 0 ? tailBottom(note) : -1;
+  return note.head ? IMAX(bottom, note.y + NOTE_HEIGHT - 1) : bottom;
+}
 
-    uint16_t bg_pixel = getBoardPixelWhenFretPressed(board_x, board_y, px);
+// copies the bar of a tail over row, which is buf or gets copied there
+static uint16_t* drawTailRow(uint16_t* buf, const uint16_t* row, int col) {
+  if (row != buf) {
+    memcpy(buf, row, NOTE_WIDTH * sizeof(uint16_t));
+  }
+  memcpy(&buf[TAIL_X], &tail_rows[col][TAIL_X], TAIL_WIDTH * sizeof(uint16_t));
+  return buf;
+}
 
-    return calculateAlpha(bg_pixel, color_pixel, alpha);
-  } // lambdaPressed
+static void forgetNotes(void) {
+  memset(column_note_count, 0, sizeof(column_note_count));
+}
 
-  return isFretPressed ? lambdaPressed : lambda;
+static void forgetSprites(void) {
+  sprite_count = 0;
+  forgetNotes();
 }
 
-uint16_t noteRemover(int x, int y, int px, int py) {
-  int board_x = x + px;
+// Row generators produce the NOTE_WIDTH pixels of column col at display row
+// y + py, where y is the upper row of the note. They either fill buf or
+// return pixels which are already in memory (highway, sprites, pressed frets).
+typedef const uint16_t* (*RowGenerator)(uint16_t* buf, int col, int y, int py);
+
+// the board, with the pressed fret drawn over it
+static const uint16_t* backgroundRow(uint16_t* buf, int col, int y, int py) {
   int board_y = y + py;
-  int board_index = board_y * LCD_PIXEL_WIDTH + board_x;
-  return board_pixels[board_index];
+  if (LCDisFretPressed(col) && inFretBand(board_y)) {
+    return &pressed_frets[col][(board_y - FRET_PRESS_Y) * NOTE_WIDTH];
+  }
+  if (board_row_plain[board_y]) {
+    return &highway_row[col_x[col]];
+  }
+  decodeBoardRow(buf, col_x[col], NOTE_WIDTH, board_y);
+  return buf;
 }
 
-uint16_t noteRemoverFretPressed(int x, int y, int px, int py) {
-  int board_x = x + px;
+// the note blended over backgroundRow
+static const uint16_t* noteRow(uint16_t* buf, int col, int y, int py) {
   int board_y = y + py;
-  if (board_y >= FRET_PRESS_Y && board_y < FRET_PRESS_Y + NOTE_HEIGHT) { 
-    return makeDrawer(true)(x, y, px, board_y - FRET_PRESS_Y);
+  if (board_row_plain[board_y] && !(LCDisFretPressed(col) && inFretBand(board_y))) {
+    return &note_sprites[col][py * NOTE_WIDTH];
+  }
+  const uint16_t* background = backgroundRow(buf, col, y, py);
+  if (background != buf) {
+    memcpy(buf, background, NOTE_WIDTH * sizeof(uint16_t));
   }
-  int board_index = board_y * LCD_PIXEL_WIDTH + board_x;
-  return board_pixels[board_index];
+  blendNoteRow(buf, col, py);
+  return buf;
+}
+
+// Assumes CS(0) and beginRect called with the first row to draw
+static void drawGeneratedRow(RowGenerator generate, int col, int y, int py) {
+  uint16_t* buf = nextRowBuffer();
+  const uint16_t* row = generate(buf, col, y, py);
+  LCDwriteSpan16(overlaySprites(buf, row, col_x[col], NOTE_WIDTH, y + py), NOTE_WIDTH);
 }
 
-// Assumes CS(0) and rectangle set
-// Draws only the note with logical upper-left pixel at (x, y)
-// Handles top/bottom edges of the screen correctly, but not left/right
-static void drawNoteHelper(int x, int y, PixelCalculator calc) {
+// Assumes CS(0)
+// Draws only the note-sized strip of column col with upper row at y
+// Handles top/bottom edges of the screen correctly
+static void drawNoteHelper(int col, int y, RowGenerator generate) {
+  int x = col_x[col];
+  int first_py = y < BOARD_FIRST_PIXEL ? BOARD_FIRST_PIXEL - y : 0; // don't start above first pixel
+  beginRect(x, y + first_py, x + NOTE_WIDTH - 1, y + NOTE_HEIGHT - 1);
   for (
-    int py = y < BOARD_FIRST_PIXEL ? BOARD_FIRST_PIXEL - y : 0; // don't start above first pixel
+    int py = first_py;
     py < NOTE_HEIGHT &&
       py + y < LCD_PIXEL_HEIGHT; // don't go below last pixel
     ++py
   ) {
-    for (int px = 0; px < NOTE_WIDTH; ++px) {
-      uint16_t pixel = calc(x, y, px, py);
-      LCDwriteData16(pixel);
-    }
+    drawGeneratedRow(generate, col, y, py);
   }
 }
 
-static const int col_x[5] = {-1, 0, 33, 65, 95};
-
-static const NoteColor col_color[5] = {-1, N_RED, N_YELLOW, N_GREEN, N_BLUE};
-
-static void drawBoardLine(int col, int starty, int width, bool isFretPressed) {
-  int startx = col_x[col];
-  for (int i = 0; i < width; ++i) {
-    uint16_t pixel = isFretPressed
-      ? getBoardPixelWhenFretPressed(startx + i, starty, i)
-      : board_pixels[BOARD_INDEX(startx + i, starty)];
-
-    LCDwriteData16(pixel);
-  }
+// true if display row y has already been moved into place by LCDscrollBoard
+static bool rowScrolled(int y) {
+  return scroll_top <= y && y < scroll_top + scroll_height
+    && !(exposed_top <= y && y < exposed_bottom);
 }
 
-
 void LCDdrawNote(int col, int y) {
-  int x = col_x[col];
-  NoteColor color = col_color[col];
-  LCDsetColorPixel(color);
+  rememberNote(col, (LcdNote){y, 0, true});
   CS(0);
-  LCDsetRectangle(x, y, x + NOTE_WIDTH - 1, y + NOTE_HEIGHT - 1);
-  drawNoteHelper(x, y, makeDrawer(LCDisFretPressed(col)));
+  drawNoteHelper(col, y, noteRow);
   CS(1);
   LCDgoto(0, 0);
 }
@@ -616,11 +1214,11 @@ void LCDdrawNote(int col, int y) {
 // It draws another note deltay pixels higher/lower according to passed flag
 // Also it fills the space unoccupied by the new note with background pixels
 // Doesn't try to draw pixels outside the screen (only up/down).
+// In scroll mode, rows which LCDscrollBoard(deltay) already moved are skipped.
 void LCDmoveNoteVertical(int col, int oldy, int deltay) {
   int x = col_x[col];
 
-  NoteColor color = col_color[col];
-  LCDsetColorPixel(color);
+  bool skip_scrolled = scroll_on && deltay == last_scroll;
 
   bool up = deltay < 0;
   bool down = !up;
@@ -629,13 +1227,13 @@ void LCDmoveNoteVertical(int col, int oldy, int deltay) {
     deltay = -deltay;
   }
 
-  bool fret_pressed = LCDisFretPressed(col);
-
   // rectangle bounds
   int upper_bound = IMAX(oldy - up   * deltay,                   BOARD_FIRST_PIXEL);
   int lower_bound = IMIN(oldy + down * deltay + NOTE_HEIGHT - 1, LCD_PIXEL_HEIGHT - 1);
 
   int new_y = oldy + deltay * (-up + down);
+  forgetNote(col, oldy);
+  rememberNote(col, (LcdNote){new_y, 0, true});
 
   if (upper_bound >= LCD_PIXEL_HEIGHT || lower_bound < BOARD_FIRST_PIXEL) {
     // nothing to draw
@@ -643,60 +1241,551 @@ void LCDmoveNoteVertical(int col, int oldy, int deltay) {
   }
 
   CS(0);
-  LCDsetRectangle(
+  beginRect(
     x,                  upper_bound,
     x + NOTE_WIDTH - 1, lower_bound
   );
 
-  // if moving down, overwrite old upper rows
-  // if up, this loop will never execute as upper_bound == new_y
-  for (int row = upper_bound; row < new_y; ++row) {
-    drawBoardLine(col, row, NOTE_WIDTH, fret_pressed);
-  }  
-
-  drawNoteHelper(x, new_y, makeDrawer(fret_pressed));
-
-  // if moving up, overwrite old lower rows
-  // if down, this loop will never execute as new_y + NOTE_HEIGHT > lower_bound
-  for (int line_y = new_y + NOTE_HEIGHT; line_y <= lower_bound; ++line_y) {
-    drawBoardLine(col, line_y, NOTE_WIDTH, fret_pressed);
+  // if moving down, old upper rows are overwritten with board
+  // if moving up, old lower rows are
+  for (int row = upper_bound; row <= lower_bound; ++row) {
+    if (skip_scrolled && rowScrolled(row)) {
+      skipRow();
+    } else if (row < new_y || row >= new_y + NOTE_HEIGHT) {
+      drawGeneratedRow(backgroundRow, col, row, 0);
+    } else {
+      drawGeneratedRow(noteRow, col, new_y, row - new_y);
+    }
   }
 
   CS(1);
   LCDgoto(0, 0);
 }
 
-// removes a note by filling its space with board pixels
-void LCDremoveNote(int col, int y) {
+// Composites row y of column col: the background, the tails and every head
+// covering it.
+static const uint16_t* columnRow(uint16_t* buf, int col, int y, const LcdNote* notes, int count) {
+  int covering = 0, last_covering = -1;
+  bool tail = false;
+  for (int i = 0; i < count; ++i) {
+    if (headCovers(notes[i], y)) {
+      covering++;
+      last_covering = i;
+    }
+    tail = tail || tailCovers(notes[i], y);
+  }
+  if (!tail && covering == 0) {
+    return backgroundRow(buf, col, y, 0);
+  }
+  if (!tail && covering == 1) {
+    return noteRow(buf, col, notes[last_covering].y, y - notes[last_covering].y);
+  }
+  bool plain = board_row_plain[y] && !(LCDisFretPressed(col) && inFretBand(y));
+  if (tail && covering == 0 && plain) {
+    return tail_rows[col];
+  }
+  const uint16_t* background = backgroundRow(buf, col, y, 0);
+  if (tail) {
+    drawTailRow(buf, background, col);
+  } else if (background != buf) {
+    memcpy(buf, background, NOTE_WIDTH * sizeof(uint16_t));
+  }
+  for (int i = 0; i < count; ++i) {
+    if (headCovers(notes[i], y)) {
+      blendNoteRow(buf, col, y - notes[i].y);
+    }
+  }
+  return buf;
+}
+
+// marks rows top to bottom, clipped to the board
+static void markRows(bool* changed, int* first, int* last, int top, int bottom) {
+  top = IMAX(top, BOARD_FIRST_PIXEL);
+  bottom = IMIN(bottom, LCD_PIXEL_HEIGHT - 1);
+  if (top > bottom) {
+    return; // off the screen
+  }
+  for (int y = top; y <= bottom; ++y) {
+    changed[y] = true;
+  }
+  *first = IMIN(*first, top);
+  *last = IMAX(*last, bottom);
+}
+
+// Assumes CS(0)
+// Draws rows top to bottom of column col with the remembered notes.
+static void drawColumnRows(int col, int top, int bottom) {
+  top = IMAX(top, BOARD_FIRST_PIXEL);
+  bottom = IMIN(bottom, LCD_PIXEL_HEIGHT - 1);
+  if (top > bottom) {
+    return;
+  }
   int x = col_x[col];
-  int upper_bound = IMAX(y, BOARD_FIRST_PIXEL);
-  int lower_bound = IMIN(y + NOTE_HEIGHT - 1, LCD_PIXEL_HEIGHT - 1);
+  beginRect(x, top, x + NOTE_WIDTH - 1, bottom);
+  for (int y = top; y <= bottom; ++y) {
+    uint16_t* buf = nextRowBuffer();
+    const uint16_t* row = columnRow(buf, col, y, column_notes[col], column_note_count[col]);
+    LCDwriteSpan16(overlaySprites(buf, row, x, NOTE_WIDTH, y), NOTE_WIDTH);
+  }
+}
 
-  if (upper_bound >= LCD_PIXEL_HEIGHT || lower_bound < BOARD_FIRST_PIXEL) {
+// Redraws every row of column col which any of its notes left or entered
+// when they all moved by deltay, top to bottom in one pass. Rows which nothing
+// touched are skipped, so only gaps between notes cost another window.
+// A tail looks the same on every row, so only the rows its ends moved over
+// change, however long it is.
+// In scroll mode, rows which LCDscrollBoard(deltay) already moved are skipped.
+// When deltay adds up several scrolls, the tails are drawn again over every
+// row the scrolls uncovered since the column was last drawn.
+void LCDdrawColumn(int col, const LcdNote* notes, int count, int deltay) {
+  // a forgotten note would be drawn over or left behind
+  assert(count <= LCD_COLUMN_NOTES);
+  column_note_count[col] = IMIN(count, LCD_COLUMN_NOTES);
+  memcpy(column_notes[col], notes, column_note_count[col] * sizeof(LcdNote));
+
+  // deltay 0 draws the notes where they are; once several scrolls added up
+  // to deltay, only rows the last one moved are known to be in place
+  int exposed_above = column_exposed_top[col];
+  int exposed_below = column_exposed_bottom[col];
+  column_exposed_top[col] = column_exposed_bottom[col] = 0;
+  bool skip_scrolled = scroll_on && deltay != 0 && deltay == last_scroll
+    && exposed_above == exposed_top && exposed_below == exposed_bottom;
+
+  bool changed[LCD_PIXEL_HEIGHT] = {};
+  int first = LCD_PIXEL_HEIGHT, last = -1;
+  for (int i = 0; i < count; ++i) {
+    LcdNote note = notes[i];
+    LcdNote old = note;
+    old.y -= deltay;
+    if (note.head) {
+      markRows(changed, &first, &last,
+        IMIN(old.y, note.y), IMAX(old.y, note.y) + NOTE_HEIGHT - 1);
+    }
+    if (note.tail <= 0) {
+      continue;
+    }
+    if (deltay == 0) {
+      markRows(changed, &first, &last, tailTop(note), tailBottom(note));
+      continue;
+    }
+    markRows(changed, &first, &last,
+      IMIN(tailTop(old), tailTop(note)), IMAX(tailTop(old), tailTop(note)) - 1);
+    if (!note.head) {
+      markRows(changed, &first, &last,
+        IMIN(tailBottom(old), tailBottom(note)) + 1, IMAX(tailBottom(old), tailBottom(note)));
+    }
+    // the board was drawn over the tail there
+    markRows(changed, &first, &last,
+      IMAX(tailTop(note), exposed_above), IMIN(tailBottom(note), exposed_below - 1));
+  }
+  if (first > last) {
     // nothing to draw
     return;
   }
-  
+
+  int x = col_x[col];
+
+  CS(0);
+  beginRect(x, first, x + NOTE_WIDTH - 1, last);
+  for (int y = first; y <= last; ++y) {
+    if (!changed[y] || (skip_scrolled && rowScrolled(y))) {
+      skipRow();
+    } else {
+      uint16_t* buf = nextRowBuffer();
+      const uint16_t* row = columnRow(buf, col, y, notes, count);
+      LCDwriteSpan16(overlaySprites(buf, row, x, NOTE_WIDTH, y), NOTE_WIDTH);
+    }
+  }
+  CS(1);
+  LCDgoto(0, 0);
+}
+
+// removes a note by drawing whatever else is remembered over its space
+void LCDremoveNote(int col, int y) {
+  LcdNote* found = findNote(col, y);
+  LcdNote note = found ? *found : (LcdNote){y, 0, true};
+  forgetNote(col, y);
+
+  CS(0);
+  drawColumnRows(col, noteTop(note), noteBottom(note));
+  CS(1);
+  LCDgoto(0, 0);
+}
+
+void LCDreplaceNote(int col, int y, LcdNote note) {
+  LcdNote* found = findNote(col, y);
+  LcdNote old = found ? *found : (LcdNote){y, 0, true};
+  if (found) {
+    *found = note;
+  } else {
+    rememberNote(col, note);
+  }
+
   CS(0);
-  LCDsetRectangle(x, upper_bound, x + NOTE_WIDTH - 1, lower_bound);
-  LCDsetColorPixel(col_color[col]);
-  drawNoteHelper(x, y, LCDisFretPressed(col) ? noteRemoverFretPressed : noteRemover);
+  drawColumnRows(col, IMIN(noteTop(old), noteTop(note)), IMAX(noteBottom(old), noteBottom(note)));
   CS(1);
   LCDgoto(0, 0);
 }
 
 bool col_pressed[5] = {};
 
+// the fret band is composited like any other rows of the column, so the
+// notes and tails in it stay on top of the pressed or released fret
 void LCDpressFret(int col) {
   col_pressed[col] = true;
-  LCDdrawNote(col, FRET_PRESS_Y);
+  CS(0);
+  drawColumnRows(col, FRET_PRESS_Y, FRET_PRESS_Y + NOTE_HEIGHT - 1);
+  CS(1);
+  LCDgoto(0, 0);
 }
 
 void LCDreleaseFret(int col) {
   col_pressed[col] = false;
-  LCDremoveNote(col, FRET_PRESS_Y);
+  CS(0);
+  drawColumnRows(col, FRET_PRESS_Y, FRET_PRESS_Y + NOTE_HEIGHT - 1);
+  CS(1);
+  LCDgoto(0, 0);
 }
 
 bool LCDisFretPressed(int col) {
   return col_pressed[col];
-}
\ No newline at end of file
+}
+
+// Composites display row y between x1 and x2 into buf: the board, pressed
+// frets and remembered notes, the sprites and then extra, unless it is NULL.
+static void compositeRow(uint16_t* buf, int x1, int x2, int y, const LcdSprite* extra) {
+  int width = x2 - x1 + 1;
+  if (y < BOARD_FIRST_PIXEL) {
+    for (int i = 0; i < width; ++i) {
+      buf[i] = BackColor;
+    }
+  } else {
+    decodeBoardRow(buf, x1, width, y);
+    for (int col = 1; col <= 4; ++col) {
+      int from = IMAX(x1, col_x[col]);
+      int to = IMIN(x2, col_x[col] + NOTE_WIDTH - 1);
+      if (from <= to) {
+        static uint16_t strip[NOTE_WIDTH];
+        const uint16_t* pixels =
+          columnRow(strip, col, y, column_notes[col], column_note_count[col]);
+        memcpy(&buf[from - x1], &pixels[from - col_x[col]], (to - from + 1) * sizeof(uint16_t));
+      }
+    }
+  }
+  overlaySprites(buf, buf, x1, width, y);
+  if (extra && spriteCovers(extra, x1, x2, y)) {
+    blendSpriteRow(buf, x1, x2, y, extra);
+  }
+}
+
+// Redraws an area (display coordinates, clipped to the screen) in one window.
+static void drawArea(int x1, int y1, int x2, int y2, const LcdSprite* extra) {
+  x1 = IMAX(x1, 0);
+  y1 = IMAX(y1, 0);
+  x2 = IMIN(x2, LCD_PIXEL_WIDTH - 1);
+  y2 = IMIN(y2, LCD_PIXEL_HEIGHT - 1);
+  if (x1 > x2 || y1 > y2) {
+    return; // off the screen
+  }
+
+  CS(0);
+  beginRect(x1, y1, x2, y2);
+  for (int y = y1; y <= y2; ++y) {
+    uint16_t* row = nextRowBuffer();
+    compositeRow(row, x1, x2, y, extra);
+    LCDwriteSpan16(row, x2 - x1 + 1);
+  }
+  CS(1);
+  LCDgoto(0, 0);
+}
+
+static void drawSpriteArea(const LcdSprite* sprite) {
+  drawArea(sprite->x, sprite->y,
+           sprite->x + sprite->image->width - 1, sprite->y + sprite->image->height - 1, NULL);
+}
+
+static int spriteIndex(const LcdSprite* sprite) {
+  for (int i = 0; i < sprite_count; ++i) {
+    if (sprites[i] == sprite) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool LCDshowSprite(LcdSprite* sprite) {
+  if (sprite_count == LCD_MAX_SPRITES || spriteIndex(sprite) >= 0) {
+    return false;
+  }
+  // after every sprite with the same z
+  int i = sprite_count++;
+  for (; i > 0 && sprites[i - 1]->z > sprite->z; --i) {
+    sprites[i] = sprites[i - 1];
+  }
+  sprites[i] = sprite;
+  drawSpriteArea(sprite);
+  return true;
+}
+
+void LCDhideSprite(LcdSprite* sprite) {
+  int i = spriteIndex(sprite);
+  if (i < 0) {
+    return;
+  }
+  for (--sprite_count; i < sprite_count; ++i) {
+    sprites[i] = sprites[i + 1];
+  }
+  drawSpriteArea(sprite);
+}
+
+void LCDmoveSprite(LcdSprite* sprite, int x, int y) {
+  int old_x = sprite->x, old_y = sprite->y;
+  sprite->x = x;
+  sprite->y = y;
+  if (spriteIndex(sprite) < 0) {
+    return;
+  }
+
+  int width = sprite->image->width, height = sprite->image->height;
+  bool overlap = x - old_x < width && old_x - x < width
+    && y - old_y < height && old_y - y < height;
+  if (overlap) {
+    int left = IMIN(x, old_x), top = IMIN(y, old_y);
+    int right = IMAX(x, old_x) + width - 1, bottom = IMAX(y, old_y) + height - 1;
+    drawArea(left, top, right, bottom, NULL);
+  } else {
+    drawArea(old_x, old_y, old_x + width - 1, old_y + height - 1, NULL);
+    drawSpriteArea(sprite);
+  }
+}
+
+// drawn over everything, but not remembered
+void LCDdrawNoteXY(int x, int y, NoteColor color) {
+  LcdSprite note = {
+    .image = &lcd_note_image,
+    .x = x,
+    .y = y,
+    .color = color_map[color],
+  };
+  drawArea(x, y, x + NOTE_WIDTH - 1, y + NOTE_HEIGHT - 1, &note);
+}
+// Hardware scrolling of the note highway
+
+// The scroll area spans from below the text to the fret row, the fret row
+// and the text stay fixed
+#define SCROLL_BOTTOM FRET_PRESS_Y
+
+// MADCTL is set with MY, so the controller numbers lines from the bottom of
+// the screen: its top fixed area is our bottom one and vice versa
+static void sendScrollStart(void) {
+  LCDwriteCommand(0x37); // VSCRSADD
+  LCDwriteData16(LCD_PIXEL_HEIGHT - SCROLL_BOTTOM + scroll_offset);
+}
+
+void LCDsetScrollMode(bool on) {
+  CS(0);
+  if (on) {
+    scroll_top = BOARD_FIRST_PIXEL;
+    scroll_height = SCROLL_BOTTOM - scroll_top;
+    scroll_offset = 0;
+
+    LCDwriteCommand(0x33); // VSCRDEF
+    LCDwriteData16(LCD_PIXEL_HEIGHT - SCROLL_BOTTOM); // top fixed area
+    LCDwriteData16(scroll_height); // scroll area
+    LCDwriteData16(scroll_top); // bottom fixed area
+    sendScrollStart();
+    scroll_on = true;
+  } else if (scroll_on) {
+    LCDwriteCommand(0x13); // NORON, back to normal display mode
+    scroll_on = false;
+    // memory rows were shifted by the scrolling, start over with a clean board
+    drawBoardRows(scroll_top, scroll_top + scroll_height - 1);
+  }
+  exposed_top = exposed_bottom = last_scroll = 0;
+  memset(column_exposed_top, 0, sizeof(column_exposed_top));
+  memset(column_exposed_bottom, 0, sizeof(column_exposed_bottom));
+  CS(1);
+  LCDgoto(0, 0);
+}
+
+bool LCDisScrollMode() {
+  return scroll_on;
+}
+
+void LCDscrollBoard(int deltay) {
+  last_scroll = deltay;
+  exposed_top = exposed_bottom = 0;
+  if (!scroll_on || deltay == 0) {
+    return;
+  }
+
+  int uncovered = IMIN(deltay < 0 ? -deltay : deltay, scroll_height);
+  scroll_offset = positiveMod(scroll_offset + deltay, scroll_height);
+
+  if (deltay > 0) {
+    exposed_top = scroll_top;
+    exposed_bottom = scroll_top + uncovered;
+  } else {
+    exposed_top = scroll_top + scroll_height - uncovered;
+    exposed_bottom = scroll_top + scroll_height;
+  }
+
+  forgetText(0, scroll_top, LCD_PIXEL_WIDTH - 1, scroll_top + scroll_height - 1);
+  CS(0);
+  sendScrollStart();
+  // whatever scrolled out at one end wrapped around to the other
+  drawBoardRows(exposed_top, exposed_bottom - 1);
+  CS(1);
+  LCDgoto(0, 0);
+
+  // the notes moved with the board, until they are drawn again
+  int scroll_bottom = scroll_top + scroll_height - 1;
+  for (int col = 1; col <= 4; ++col) {
+    for (int i = 0; i < column_note_count[col]; ++i) {
+      column_notes[col][i].y += deltay;
+    }
+    // so did the rows uncovered before, both ends are on the board's edges
+    int top = exposed_top, bottom = exposed_bottom;
+    if (column_exposed_top[col] < column_exposed_bottom[col]) {
+      int moved_top = IMAX(column_exposed_top[col] + deltay, scroll_top);
+      int moved_bottom = IMIN(column_exposed_bottom[col] + deltay, scroll_bottom + 1);
+      top = IMIN(top, moved_top);
+      bottom = IMAX(bottom, moved_bottom);
+    }
+    column_exposed_top[col] = top;
+    column_exposed_bottom[col] = bottom;
+  }
+  // the sprites did too, put them back
+  for (int i = 0; i < sprite_count; ++i) {
+    const LcdSprite* sprite = sprites[i];
+    int upper_y = sprite->y + (deltay < 0 ? deltay : 0);
+    int lower_y = sprite->y + (deltay > 0 ? deltay : 0);
+    int top = IMAX(upper_y, scroll_top);
+    int bottom = IMIN(lower_y + sprite->image->height - 1, scroll_bottom);
+    drawArea(sprite->x, top, sprite->x + sprite->image->width - 1, bottom, NULL);
+  }
+}
+
+// Cycles spent computing the pixels of one note (nothing is sent) with the
+// original per-pixel divisions, with the lookup tables, and copying a sprite,
+// then the average cycles per note row of both row blending kernels.
+LcdBlendCycles LCDbenchmarkBlend(uint32_t (*cycles)(void)) {
+  const int col = 2;
+  const int x = col_x[col];
+  uint16_t color = color_map[col_color[col]];
+  static volatile uint16_t sink;
+  LcdBlendCycles result;
+
+  uint32_t start = cycles();
+  for (int py = 0; py < NOTE_HEIGHT; ++py) {
+    for (int px = 0; px < NOTE_WIDTH; ++px) {
+      sink = calculateAlphaDivide(highway_row[x + px],
+                                  color, note_pixels[py * NOTE_WIDTH + px]);
+    }
+  }
+  result.divide = cycles() - start;
+
+  start = cycles();
+  for (int py = 0; py < NOTE_HEIGHT; ++py) {
+    for (int px = 0; px < NOTE_WIDTH; ++px) {
+      sink = calculateAlpha(highway_row[x + px],
+                            color, note_pixels[py * NOTE_WIDTH + px]);
+    }
+  }
+  result.lookup = cycles() - start;
+
+  start = cycles();
+  for (int i = 0; i < NOTE_SIZE; ++i) {
+    sink = note_sprites[col][i];
+  }
+  result.sprite = cycles() - start;
+
+  // whole rows blended in place, as blendNoteRow does
+  uint16_t* row = nextRowBuffer();
+  result.row_lookup = 0;
+  for (int py = 0; py < NOTE_HEIGHT; ++py) {
+    const uint16_t* alpha = &note_pixels[py * NOTE_WIDTH];
+    memcpy(row, &highway_row[x], NOTE_WIDTH * sizeof(uint16_t));
+    start = cycles();
+    LCDblendRow(row, color, alpha, NOTE_WIDTH);
+    result.row_lookup += cycles() - start;
+  }
+  result.row_lookup /= NOTE_HEIGHT;
+
+  (void)sink;
+  return result;
+}
+
+// Flash taken by the compressed board and cycles taken to decode all its rows.
+LcdBoardCost LCDbenchmarkBoard(uint32_t (*cycles)(void)) {
+  uint16_t* row = nextRowBuffer();
+  LcdBoardCost result = {
+    .flash_bytes = sizeof(board_runs) + sizeof(board_rows),
+  };
+  uint32_t start = cycles();
+  for (int y = 0; y < LCD_PIXEL_HEIGHT; ++y) {
+    decodeBoardRow(row, 0, LCD_PIXEL_WIDTH, y);
+  }
+  result.decode_cycles = cycles() - start;
+  return result;
+}
+
+// Retained mode
+
+void LCDsetRetainedMode(bool on) {
+#ifdef LCD_FRAMEBUFFER
+  if (on && !retained) {
+    retained = true;
+    dirty_count = 0;
+    // the framebuffer has to start out matching the screen
+    LCDclear();
+  } else if (!on && retained) {
+    LCDflush();
+    retained = false;
+  }
+#else
+  (void)on;
+#endif
+}
+
+bool LCDisRetainedMode() {
+  return retained;
+}
+
+void LCDflush() {
+#ifdef LCD_FRAMEBUFFER
+  if (!retained || dirty_count == 0) {
+    return;
+  }
+  CS(0);
+  for (int i = 0; i < dirty_count; ++i) {
+    Area a = dirty[i];
+    int width = a.x2 - a.x1 + 1;
+    LCDsetRectangle(a.x1, a.y1, a.x2, a.y2);
+    if (width == LCD_PIXEL_WIDTH) {
+      // whole rows are contiguous
+      sendPixels(framebuffer[a.y1], (a.y2 - a.y1 + 1) * LCD_PIXEL_WIDTH);
+    } else {
+      for (int y = a.y1; y <= a.y2; ++y) {
+        sendPixels(&framebuffer[y][a.x1], width);
+      }
+    }
+  }
+  dirty_count = 0;
+  CS(1);
+#endif
+}
+
+// Pixel format
+
+void LCDsetPixelFormat(LcdPixelFormat format) {
+  CS(0);
+  LCDwriteCommand(0x3A); // COLMOD
+  LCDwriteData8(format == LCD_RGB444 ? 0x03 : 0x05);
+  CS(1);
+  pixel_format = format;
+}
+
+LcdPixelFormat LCDgetPixelFormat() {
+  return pixel_format;
+}
@@ -0,0 +1,104 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lcd_transport.h"
+#include "lcd_pins.h"
+
+// The original transport of the instructor-provided driver:
+// every bit is clocked out by hand with GPIO writes.
+// Slow, but works with the LCD connected to any four pins.
+
+#ifndef LCD_SPI_MOCK
+
+static void RCCconfigure(void) {
+  /* Enable GPIO clocks. */
+  RCC->AHB1ENR |= RCC_LCD_CS | RCC_LCD_A0 | RCC_LCD_SDA | RCC_LCD_SCK;
+}
+
+static void GPIOconfigure(void) {
+  CS(1); /* Set CS inactive. */
+  GPIOoutConfigure(GPIO_LCD_CS, LCD_CS_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+
+  A0(1); /* Data are sent default. */
+  GPIOoutConfigure(GPIO_LCD_A0, LCD_A0_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+
+  SDA(0);
+  GPIOoutConfigure(GPIO_LCD_SDA, LCD_SDA_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+
+  SCK(0); /* Data bit is written on rising clock edge. */
+  GPIOoutConfigure(GPIO_LCD_SCK, LCD_SCK_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+}
+
+#else
+
+static void RCCconfigure(void) {}
+
+static void GPIOconfigure(void) {
+  CS(1);
+  A0(1);
+  SDA(0);
+  SCK(0);
+}
+
+#endif // LCD_SPI_MOCK
+
+static void LCDwriteSerial(uint32_t data, uint32_t length) {
+  uint32_t mask;
+
+  mask = 1U << (length - 1);
+  while (length > 0) {
+    SDA(data & mask); /* Set bit. */
+    --length;         /* Add some delay. */
+    SCK(1);           /* Rising edge writes bit. */
+    mask >>= 1;       /* Add some delay. */
+    SCK(0);           /* Falling edge ends the bit transmission. */
+  }
+}
+
+static void bitbangConfigure(void) {
+  /* See Errata, 2.1.6 Delay after an RCC peripheral clock enabling */
+  RCCconfigure();
+  GPIOconfigure();
+}
+
+static void bitbangCommand(uint32_t cmd) {
+  A0(0);
+  LCDwriteSerial(cmd, 8);
+  A0(1);
+}
+
+static void bitbangData(uint32_t data, uint32_t bits) {
+  /* A0(1); is already set */
+  LCDwriteSerial(data, bits);
+}
+
+static void bitbangPixels(const uint16_t* pixels, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    LCDwriteSerial(pixels[i], 16);
+  }
+}
+
+static void bitbangFill(uint16_t color, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    LCDwriteSerial(color, 16);
+  }
+}
+
+static void bitbangWait(void) {
+  // every write above is synchronous
+}
+
+const LcdTransport lcd_bitbang_transport = {
+  .configure = bitbangConfigure,
+  .cs = CS,
+  .command = bitbangCommand,
+  .data = bitbangData,
+  .pixels = bitbangPixels,
+  .fill = bitbangFill,
+  .wait = bitbangWait,
+};
@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+#include "lcd_blend.h"
+
+#define RED_SHIFT 11
+#define GREEN_SHIFT 5
+#define BLUE_SHIFT 0
+
+#define MAX_5BIT 31
+#define MAX_6BIT 63
+
+#define CHANNEL(pixel, shift, max) (((pixel) >> (shift)) & (max))
+
+// mul_div_5bit[a][b] == a * b / 31, mul_div_6bit[a][b] == a * b / 63,
+// so blending a single pixel needs no divisions
+static uint8_t mul_div_5bit[MAX_5BIT + 1][MAX_5BIT + 1];
+static uint8_t mul_div_6bit[MAX_6BIT + 1][MAX_6BIT + 1];
+
+void LCDinitBlendTables(void) {
+  for (uint32_t a = 0; a <= MAX_5BIT; ++a) {
+    for (uint32_t b = 0; b <= MAX_5BIT; ++b) {
+      mul_div_5bit[a][b] = a * b / MAX_5BIT;
+    }
+  }
+  for (uint32_t a = 0; a <= MAX_6BIT; ++a) {
+    for (uint32_t b = 0; b <= MAX_6BIT; ++b) {
+      mul_div_6bit[a][b] = a * b / MAX_6BIT;
+    }
+  }
+}
+
+uint16_t calculateAlpha(uint16_t bg_pixel, uint16_t img_pixel, uint16_t img_alpha) {
+  uint32_t alpha_r = CHANNEL(img_alpha, RED_SHIFT, MAX_5BIT);
+  uint32_t alpha_g = CHANNEL(img_alpha, GREEN_SHIFT, MAX_6BIT);
+  uint32_t alpha_b = CHANNEL(img_alpha, BLUE_SHIFT, MAX_5BIT);
+
+  uint32_t pixel_r = mul_div_5bit[CHANNEL(img_pixel, RED_SHIFT, MAX_5BIT)][alpha_r]
+                   + mul_div_5bit[CHANNEL(bg_pixel, RED_SHIFT, MAX_5BIT)][MAX_5BIT - alpha_r];
+  uint32_t pixel_g = mul_div_6bit[CHANNEL(img_pixel, GREEN_SHIFT, MAX_6BIT)][alpha_g]
+                   + mul_div_6bit[CHANNEL(bg_pixel, GREEN_SHIFT, MAX_6BIT)][MAX_6BIT - alpha_g];
+  uint32_t pixel_b = mul_div_5bit[CHANNEL(img_pixel, BLUE_SHIFT, MAX_5BIT)][alpha_b]
+                   + mul_div_5bit[CHANNEL(bg_pixel, BLUE_SHIFT, MAX_5BIT)][MAX_5BIT - alpha_b];
+
+  return pixel_r << RED_SHIFT | pixel_g << GREEN_SHIFT | pixel_b << BLUE_SHIFT;
+}
+
+void LCDblendRow(uint16_t* row, uint16_t img_pixel, const uint16_t* alpha, int count) {
+  for (int i = 0; i < count; ++i) {
+    row[i] = calculateAlpha(row[i], img_pixel, alpha[i]);
+  }
+}
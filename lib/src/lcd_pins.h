@@ -0,0 +1,89 @@
+#ifndef LCD_PINS_H
+#define LCD_PINS_H
+
+// LCD control lines shared by the transports in lcd_bitbang.c and lcd_spi.c.
+// Host builds define LCD_SPI_MOCK and route every pin change to the SPI mock,
+// which decodes the wire back into command/data bytes.
+
+#include <stdint.h>
+
+#ifdef LCD_SPI_MOCK
+
+#include "spi_mock.h"
+
+static inline void CS(uint32_t bit)  { spiMockPin(LCD_PIN_CS, bit); }
+static inline void A0(uint32_t bit)  { spiMockPin(LCD_PIN_A0, bit); }
+static inline void SDA(uint32_t bit) { spiMockPin(LCD_PIN_SDA, bit); }
+static inline void SCK(uint32_t bit) { spiMockPin(LCD_PIN_SCK, bit); }
+
+#else
+
+#include <stm32.h>
+#include <gpio.h>
+#include <lcd_board_def.h>
+
+/*
+ * Microcontroller pin definitions:
+ * constants LCD_*_GPIO_N are port letter codes (A, B, C, ...),
+ * constants LCD_*_PIN_N are the port output numbers (from 0 to 15),
+ * constants GPIO_LCD_* are memory pointers,
+ * constants PIN_LCD_* and RCC_LCD_* are bit masks.
+ */
+
+#define GPIO_LCD_CS   xcat(GPIO, LCD_CS_GPIO_N)
+#define GPIO_LCD_A0   xcat(GPIO, LCD_A0_GPIO_N)
+#define GPIO_LCD_SDA  xcat(GPIO, LCD_SDA_GPIO_N)
+#define GPIO_LCD_SCK  xcat(GPIO, LCD_SCK_GPIO_N)
+
+#define PIN_LCD_CS    (1U << LCD_CS_PIN_N)
+#define PIN_LCD_A0    (1U << LCD_A0_PIN_N)
+#define PIN_LCD_SDA   (1U << LCD_SDA_PIN_N)
+#define PIN_LCD_SCK   (1U << LCD_SCK_PIN_N)
+
+#define RCC_LCD_CS    xcat3(RCC_AHB1ENR_GPIO, LCD_CS_GPIO_N, EN)
+#define RCC_LCD_A0    xcat3(RCC_AHB1ENR_GPIO, LCD_A0_GPIO_N, EN)
+#define RCC_LCD_SDA   xcat3(RCC_AHB1ENR_GPIO, LCD_SDA_GPIO_N, EN)
+#define RCC_LCD_SCK   xcat3(RCC_AHB1ENR_GPIO, LCD_SCK_GPIO_N, EN)
+
+/* The following four functions are inlined and "if" statement is
+eliminated during optimization if the "bit" argument is a constant. */
+
+static inline void CS(uint32_t bit) {
+  if (bit) {
+    GPIO_LCD_CS->BSRR = PIN_LCD_CS; /* Activate chip select line. */
+  }
+  else {
+    GPIO_LCD_CS->BSRR = PIN_LCD_CS << 16; /* Deactivate chip select line. */
+  }
+}
+
+static inline void A0(uint32_t bit) {
+  if (bit) {
+    GPIO_LCD_A0->BSRR = PIN_LCD_A0; /* Set data/command line to data. */
+  }
+  else {
+    GPIO_LCD_A0->BSRR = PIN_LCD_A0 << 16; /* Set data/command line to command. */
+  }
+}
+
+static inline void SDA(uint32_t bit) {
+  if (bit) {
+    GPIO_LCD_SDA->BSRR = PIN_LCD_SDA; /* Set data bit one. */
+  }
+  else {
+    GPIO_LCD_SDA->BSRR = PIN_LCD_SDA << 16; /* Set data bit zero. */
+  }
+}
+
+static inline void SCK(uint32_t bit) {
+  if (bit) {
+    GPIO_LCD_SCK->BSRR = PIN_LCD_SCK; /* Rising clock edge. */
+  }
+  else {
+    GPIO_LCD_SCK->BSRR = PIN_LCD_SCK << 16; /* Falling clock edge. */
+  }
+}
+
+#endif // LCD_SPI_MOCK
+
+#endif // LCD_PINS_H
@@ -0,0 +1,241 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lcd_transport.h"
+#include "lcd_pins.h"
+
+// Hardware SPI transport for the ST7735S.
+//
+// Commands and parameters go out as 8-bit frames written straight to DR.
+// Pixel runs switch the SPI to 16-bit frames (so the little-endian uint16_t
+// pixels come out MSB first, as the controller wants them) and are handed to
+// DMA, which lets the caller go on computing while the rectangle is sent.
+// CS and A0 stay plain GPIO lines, they may only change once the SPI is idle.
+// The controller is alone on the bus, so CS is held active for good after
+// configuration - otherwise every CS(1) in lcd.c would have to wait for the
+// DMA, and drawing calls could never return before their pixels are sent.
+
+// DMA can move at most this many frames in one go (NDTR is 16 bits)
+#define MAX_DMA_RUN 0xffffU
+
+#ifndef LCD_SPI_MOCK
+
+// The defaults assume SDA/SCK are routed to SPI1 MOSI/SCK (alternate function 5).
+// DMA2 stream 3 channel 3 is SPI1_TX, and isn't used by dma_uart.c.
+// All of these can be overridden from the Makefile for a different wiring.
+#ifndef LCD_SPI
+#define LCD_SPI              SPI1
+#define LCD_SPI_AF           GPIO_AF_SPI1
+#define LCD_SPI_CLOCK_ENABLE (RCC->APB2ENR |= RCC_APB2ENR_SPI1EN)
+#define LCD_DMA              DMA2
+#define LCD_DMA_STREAM       DMA2_Stream3
+#define LCD_DMA_CHANNEL      3U
+#define LCD_DMA_CLOCK_ENABLE (RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN)
+#define LCD_DMA_CLEAR_FLAGS \
+  (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 \
+  | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+#define LCD_DMA_IFCR         LIFCR
+#endif
+
+static void RCCconfigure(void) {
+  RCC->AHB1ENR |= RCC_LCD_CS | RCC_LCD_A0 | RCC_LCD_SDA | RCC_LCD_SCK;
+  LCD_SPI_CLOCK_ENABLE;
+  LCD_DMA_CLOCK_ENABLE;
+}
+
+static void GPIOconfigure(void) {
+  CS(1); /* Set CS inactive. */
+  GPIOoutConfigure(GPIO_LCD_CS, LCD_CS_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+
+  A0(1); /* Data are sent default. */
+  GPIOoutConfigure(GPIO_LCD_A0, LCD_A0_PIN_N, GPIO_OType_PP,
+                   GPIO_High_Speed, GPIO_PuPd_NOPULL);
+
+  GPIOafConfigure(GPIO_LCD_SDA, LCD_SDA_PIN_N, GPIO_OType_PP,
+                  GPIO_High_Speed, GPIO_PuPd_NOPULL, LCD_SPI_AF);
+  GPIOafConfigure(GPIO_LCD_SCK, LCD_SCK_PIN_N, GPIO_OType_PP,
+                  GPIO_High_Speed, GPIO_PuPd_NOPULL, LCD_SPI_AF);
+}
+
+static void SPIconfigure(void) {
+  // master, software slave select, clock idle low and data sampled on the
+  // rising edge (same as the bit-banged transport), fPCLK / 2
+  LCD_SPI->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;
+  LCD_SPI->CR2 = SPI_CR2_TXDMAEN;
+  LCD_SPI->CR1 |= SPI_CR1_SPE;
+
+  LCD_DMA_STREAM->CR = 0;
+  LCD_DMA_STREAM->PAR = (uint32_t)&LCD_SPI->DR;
+}
+
+static bool dmaBusy(void) {
+  return LCD_DMA_STREAM->CR & DMA_SxCR_EN;
+}
+
+static void spiWaitIdle(void) {
+  while (!(LCD_SPI->SR & SPI_SR_TXE)) {}
+  while (LCD_SPI->SR & SPI_SR_BSY) {}
+}
+
+static void spiWriteFrame(uint32_t frame) {
+  while (!(LCD_SPI->SR & SPI_SR_TXE)) {}
+  LCD_SPI->DR = frame;
+}
+
+// only call when idle
+static void spiSetFrame16(bool frame16) {
+  LCD_SPI->CR1 &= ~SPI_CR1_SPE;
+  if (frame16) {
+    LCD_SPI->CR1 |= SPI_CR1_DFF;
+  } else {
+    LCD_SPI->CR1 &= ~SPI_CR1_DFF;
+  }
+  LCD_SPI->CR1 |= SPI_CR1_SPE;
+}
+
+static void dmaStart(const uint16_t* src, uint32_t count, bool increment) {
+  LCD_DMA->LCD_DMA_IFCR = LCD_DMA_CLEAR_FLAGS;
+  LCD_DMA_STREAM->M0AR = (uint32_t)src;
+  LCD_DMA_STREAM->NDTR = count;
+  LCD_DMA_STREAM->CR =
+      LCD_DMA_CHANNEL << 25
+    | DMA_SxCR_PL_1
+    | DMA_SxCR_MSIZE_0
+    | DMA_SxCR_PSIZE_0
+    | (increment ? DMA_SxCR_MINC : 0)
+    | DMA_SxCR_DIR_0
+    | DMA_SxCR_EN;
+}
+
+#else
+
+// host build, see host/src/spi_mock.c
+
+static void RCCconfigure(void) {}
+
+static void GPIOconfigure(void) {
+  CS(1);
+  A0(1);
+}
+
+static void SPIconfigure(void) {}
+
+// The mock "DMA" reads its source only once the transfer is waited for, as
+// late as the real one could, so a buffer reused too early shows on the wire.
+static struct {
+  const uint16_t* src;
+  uint32_t count;
+  bool increment;
+} dma;
+
+static bool dmaBusy(void) {
+  for (; dma.count > 0; --dma.count) {
+    spiMockFrame(*dma.src, 16);
+    dma.src += dma.increment;
+  }
+  return false;
+}
+
+static void spiWaitIdle(void) {}
+
+static bool frame16 = false;
+
+static void spiWriteFrame(uint32_t frame) {
+  spiMockFrame(frame, frame16 ? 16 : 8);
+}
+
+static void spiSetFrame16(bool on) {
+  frame16 = on;
+}
+
+static void dmaStart(const uint16_t* src, uint32_t count, bool increment) {
+  dma.src = src;
+  dma.count = count;
+  dma.increment = increment;
+}
+
+#endif // LCD_SPI_MOCK
+
+static bool in_frame16 = false;
+
+static void spiWait(void) {
+  while (dmaBusy()) {}
+  spiWaitIdle();
+}
+
+static void useFrame16(bool on) {
+  if (in_frame16 != on) {
+    spiWait();
+    spiSetFrame16(on);
+    in_frame16 = on;
+  }
+}
+
+// kept here while DMA reads it, fill() uses it as a non-incremented source
+static uint16_t fill_color;
+
+static void spiConfigure(void) {
+  RCCconfigure();
+  GPIOconfigure();
+  SPIconfigure();
+  in_frame16 = false;
+  CS(0);
+}
+
+static void spiCS(uint32_t bit) {
+  // see the comment at the top, CS never goes inactive
+  (void)bit;
+}
+
+static void spiCommand(uint32_t cmd) {
+  useFrame16(false);
+  spiWait();
+  A0(0);
+  spiWriteFrame(cmd & 0xff);
+  spiWaitIdle();
+  A0(1);
+}
+
+static void spiData(uint32_t data, uint32_t bits) {
+  useFrame16(false);
+  spiWait();
+  while (bits > 0) {
+    bits -= 8;
+    spiWriteFrame((data >> bits) & 0xff);
+  }
+}
+
+static void spiPixels(const uint16_t* pixels, size_t count) {
+  useFrame16(true);
+  while (count > 0) {
+    uint32_t run = count > MAX_DMA_RUN ? MAX_DMA_RUN : count;
+    spiWait();
+    dmaStart(pixels, run, true);
+    pixels += run;
+    count -= run;
+  }
+}
+
+static void spiFill(uint16_t color, size_t count) {
+  useFrame16(true);
+  spiWait();
+  fill_color = color;
+  while (count > 0) {
+    uint32_t run = count > MAX_DMA_RUN ? MAX_DMA_RUN : count;
+    spiWait();
+    dmaStart(&fill_color, run, false);
+    count -= run;
+  }
+}
+
+const LcdTransport lcd_spi_transport = {
+  .configure = spiConfigure,
+  .cs = spiCS,
+  .command = spiCommand,
+  .data = spiData,
+  .pixels = spiPixels,
+  .fill = spiFill,
+  .wait = spiWait,
+};
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dma_uart.h"
+#include "trace.h"
+
+struct TraceRing trace_ring;
+
+void traceFlush() {
+  // one chunk is sent at a time, straight from the ring, and only when
+  // nothing else is: so once the UART is idle again, it's been sent
+  if (!dmaSendIdle()) {
+    return;
+  }
+  trace_ring.tail += trace_ring.sending;
+  trace_ring.sending = 0;
+
+  if (trace_ring.dropped > 0 && trace_ring.head - trace_ring.tail < TRACE_SIZE) {
+    uint32_t dropped = trace_ring.dropped;
+    trace_ring.dropped = 0;
+    trace(TR_DROPPED, 0, dropped > UINT16_MAX ? UINT16_MAX : dropped);
+  }
+
+  uint32_t count = trace_ring.head - trace_ring.tail;
+  if (count == 0) {
+    return;
+  }
+  // up to the end of the ring, the rest goes next time
+  uint32_t start = trace_ring.tail & (TRACE_SIZE - 1);
+  if (start + count > TRACE_SIZE) {
+    count = TRACE_SIZE - start;
+  }
+  trace_ring.sending = count;
+  dmaSend((const char*)&trace_ring.events[start], count * sizeof(trace_ring.events[0]));
+}